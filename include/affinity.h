@@ -0,0 +1,33 @@
+/** ------------------------------------------------------------------------------------
+ *  File: affinity.h
+ *  Description: CPU affinity and NUMA placement of worker threads.
+ *  ------------------------------------------------------------------------------------ */
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+#include <pthread.h>
+
+#define AFFINITY_ANY_NODE  -1
+#define AFFINITY_MAX_CPUS 256
+
+/**
+ *  Fill cpus with at most n ids of the CPUs belonging to NUMA node 'node'.
+ *  If node is AFFINITY_ANY_NODE all CPUs the process is allowed to run on
+ *  are returned.
+ *  Returns the number of CPUs found, zero if none or on failure.
+ */
+int affinity_cpus (int /* node */, int* /* cpus */, int /* n */);
+
+/**
+ *  Pin thread to a single CPU.
+ *  Returns non-zero on failure.
+ */
+int affinity_pin (pthread_t /* thread */, int /* cpu */);
+
+/**
+ *  Let thread run on any of the n CPUs in cpus, such as those of a node.
+ *  Returns non-zero on failure.
+ */
+int affinity_bind (pthread_t /* thread */, const int* /* cpus */, int /* n */);
+
+#endif /* _AFFINITY_H */
@@ -0,0 +1,20 @@
+/** ------------------------------------------------------------------------------------
+ *  File: cpu.h
+ *  Description: Runtime detection of the SIMD instruction sets of the host CPU.
+ *  ------------------------------------------------------------------------------------ */
+#ifndef _CPU_H
+#define _CPU_H
+
+#define CPU_SSE41   (1 << 0)
+#define CPU_AVX2    (1 << 1) // AVX2 and FMA
+#define CPU_AVX512  (1 << 2) // AVX-512 F and BW
+
+/**
+ *  Probe the CPU with cpuid.
+ *  Returns the CPU_* flags of the instruction sets that are supported both
+ *  by the CPU and by the operating system (the register state is saved on
+ *  context switches).
+ */
+int cpu_features () ;
+
+#endif /* _CPU_H */
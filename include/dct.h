@@ -36,4 +36,61 @@ void fdct2  (int16_t* block, float destination[8][8]) ;
  */
 void ifdct2 (int16_t* block, float destination[8][8]) ;
 
+/**
+ *  Scaled Inverse 2-D Cosine Transform.
+ *  Arai, Agui & Nakajima algorithm taking quantized coefficients.
+ *  The dequantization is done with q, a quantization table premultiplied
+ *  by ifdct2_scale_table, and the level shift in the last stage so the
+ *  result is stored as pixels clamped to bytes.
+ */
+void ifdct2_scaled (int16_t* block, const float* q, uint8_t destination[8][8]) ;
+
+/**
+ *  ifdct2_scaled for blocks where only the top left 4x4 coefficients,
+ *  the lowest frequencies, can be nonzero.
+ */
+void ifdct2_scaled_4x4 (int16_t* block, const float* q, uint8_t destination[8][8]) ;
+
+/**
+ *  Reduced Inverse 2-D Cosine Transform.
+ *  Reconstructs a size x size (1, 2 or 4) version of the block from its
+ *  size x size lowest frequencies, dequantized with q, to the top left
+ *  corner of destination. Used to decode at 1/8, 1/4 or 1/2 of the size.
+ */
+void ifdct2_reduced (int16_t* block, const float* q, int size, uint8_t destination[8][8]) ;
+
+/**
+ *  Premultiply the quantization table q by the scale factors of ifdct2_scaled.
+ */
+void ifdct2_scale_table (const float* q, float* destination) ;
+
+/**
+ *  Integer Inverse 2-D Cosine Transform.
+ *  Fixed point version of the Loeffler, Ligtenberg & Moschytz algorithm
+ *  with 13-bit constants, same accuracy as the islow transform of libjpeg.
+ *  The result is only computed with integers, and therefore bit-exact
+ *  wherever it runs, and clamped to bytes.
+ */
+void iidct2 (int16_t* block, uint8_t destination[8][8]) ;
+
+/**
+ *  AVX2 versions of the transforms working on n consecutive blocks per call
+ *  with the transposes done in registers. Only available on CPUs supporting AVX2 and FMA.
+ *
+ *  fdct_avx2 level shifts the pixels, transforms them and stores the
+ *  coefficients rounded to integers in place.
+ *  quantize_avx2 quantizes the coefficients in place with the divisors of
+ *  quantization_divisors, which must not need the scalar fallback.
+ *  idct_avx2 dequantizes the coefficients with q, transforms them and stores
+ *  them level shifted and clamped as 64 bytes per block to destination.
+ *  iidct_avx2 does the same with the fixed point transform of iidct2, with
+ *  the same result; q has to hold integers. It works on two blocks at a time
+ *  in 16-bit lanes and falls back to iidct2 for the blocks whose first pass
+ *  does not fit in 16 bits.
+ */
+void fdct_avx2 (int16_t* blocks, int n) ;
+void quantize_avx2 (int16_t* blocks, int n, const uint16_t* divisors) ;
+void idct_avx2 (int16_t* blocks, int n, const float* q, uint8_t* destination) ;
+void iidct_avx2 (int16_t* blocks, int n, const float* q, uint8_t* destination) ;
+
 #endif
@@ -0,0 +1,98 @@
+/**
+ *  File: decode.h
+ *  Description:
+ *      Bounds-safe helpers shared by the entropy decoders of the backends
+ */
+#ifndef _DECODE_H
+#define _DECODE_H
+
+#include "jpeg/jpeg.h"
+#include "huffman.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+
+
+#define DECODE_BLOCK_TSIZE (JPEG_BLOCK_SIZE * JPEG_BLOCK_SIZE)
+
+
+/* raster index of the coefficients in zig zag order */
+static const uint8_t decode_zigzag[DECODE_BLOCK_TSIZE] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+
+/**
+ *  Check a decoded AC symbol, at zig zag index i after its run of zeroes.
+ *  Called once per code, it bounds the bits a block reads and the index
+ *  written, so a corrupt stream can not decode past the end of a block.
+ *  Returns non-zero if the block is corrupt.
+ */
+static inline int corrupt_code (int i, uint8_t symbol)
+{
+    return i >= DECODE_BLOCK_TSIZE || symbol == HUFFMAN_INVALID;
+}
+
+/**
+ *  Zero the coefficients of a block up to zig zag index last, all a decoded
+ *  block can have written, so it is cleared for the next decode without a
+ *  memset of the whole block.
+ */
+static inline void clear_block (int16_t* block, int last)
+{
+    for (int i = 0; i <= last; i ++)
+        block[decode_zigzag[i]] = 0;
+}
+
+/**
+ *  Skip the AC coefficients of a block looking only at the code lengths in
+ *  table, filled by create_huffman_ac_skip_table.
+ *  Every code but the end of block covers a coefficient or more, so a block
+ *  has at most DECODE_BLOCK_TSIZE of them and the next 3 bytes the table
+ *  needs are within the padding.
+ *  Returns non-zero on a corrupt stream.
+ */
+static inline int skip_ac (const uint8_t* table, const uint8_t* data, int* p)
+{
+    uint8_t  bits;
+    uint32_t window;
+
+    for (int i = 0; i < DECODE_BLOCK_TSIZE; i ++)
+    {
+        const uint8_t* b = data + ((*p) >> 3);
+        window = (b[0] << 16 | b[1] << 8 | b[2]) >> (8 - ((*p) & 7));
+        bits   = table[window & ((1 << HUFFMAN_SKIP_BITS) - 1)];
+        if (bits == HUFFMAN_SKIP_INVALID)
+            return 1;
+        *p += bits & ~HUFFMAN_SKIP_EOB;
+        if (bits & HUFFMAN_SKIP_EOB)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ *  Read where the 4 channels of a frame of size bytes start to p and set end
+ *  to the bits of the frame.
+ *  Returns non-zero if the frame is too short or the channels do not start
+ *  in order within it.
+ */
+static inline int read_header (const uint8_t* data, size_t size, int p[4], int* end)
+{
+    if (size < JPEG_HEADER_SIZE || size > (INT_MAX >> 3) - JPEG_DECODE_PADDING)
+        return 1;
+    *end = size << 3;
+    p[0] = JPEG_HEADER_SIZE << 3;
+    memcpy (&p[1], data, 3 * sizeof (int));
+    for (int c = 1; c < 4; c ++)
+        if (p[c] < p[c - 1] || p[c] > *end)
+            return 1;
+    return 0;
+}
+
+#endif
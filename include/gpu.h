@@ -11,9 +11,11 @@
 
 /**
  *  Initialize OpenCL components for GPGPU.
+ *  If integer_idct is non-zero blocks are decompressed with the fixed point
+ *  transform instead of floats.
  *  Returns non-zero on failure on connecting to the device.
  */
-int init_opencl (int /* width */, int /* height */, GLuint /* texture */) ;
+int init_opencl (int /* width */, int /* height */, GLuint /* texture */, int /* integer_idct */) ;
 
 /**
  *  Deinitialize OpenCL components.
@@ -22,6 +24,8 @@ void deinit_opencl ();
 
 /**
  *  Decompress blocks from pointer blocks into destination buffer.
+ *  blocks holds 64 contiguous coefficients in rows per block, the Y blocks in
+ *  raster order followed by the U and then the V blocks.
  */
 void decompress_blocks (int16_t* /* blocks */, uint8_t* /* destination */) ;
 
@@ -12,6 +12,12 @@
 #define MAX_RUN_LEN 15
 #define MAX_SIZE    10
 
+#define HUFFMAN_SKIP_BITS    16   // longest AC code
+#define HUFFMAN_SKIP_EOB     0x80 // flag of the end of block code
+#define HUFFMAN_SKIP_INVALID 0xFF
+
+#define HUFFMAN_INVALID      0xFF // symbol decoded from bit patterns no code starts with
+
 
 /**
  *  Represents a node within a Huffman tree.
@@ -25,14 +31,15 @@ struct huffman_tree_node
 
 /**
  *  Create a new huffman tree after the AC coefficients table codes
- *  with the supplied node as root.
+ *  with the supplied node as root. Bit patterns no code starts with end in
+ *  a leaf with the symbol HUFFMAN_INVALID, so any stream decodes.
  *  destroy_huffman_tree needs to be called on the root to free memory.
  */
 void create_huffman_ac_tree (struct huffman_tree_node* root) ;
 
 /**
  *  Create a new huffman tree after the DC coefficients table codes
- *  with the supplied node as root.
+ *  with the supplied node as root, with HUFFMAN_INVALID leaves like the AC tree.
  *  destroy_huffman_tree needs to be called on the root to free memory.
  */
 void create_huffman_dc_tree (struct huffman_tree_node* root) ;
@@ -45,12 +52,36 @@ void create_huffman_dc_tree (struct huffman_tree_node* root) ;
  */
 uint8_t decode_huffman_value (struct huffman_tree_node* tree, uint8_t* buffer, int* p) ;
 
+/**
+ *  Fill table, indexed by the next HUFFMAN_SKIP_BITS bits of a stream, with the
+ *  number of bits taken by the AC code starting there together with the
+ *  amplitude following it. Used to skip AC coefficients without decoding them.
+ *  The end of block code has HUFFMAN_SKIP_EOB set in addition and bit patterns
+ *  no code starts with map to HUFFMAN_SKIP_INVALID.
+ */
+void create_huffman_ac_skip_table (uint8_t table[1 << HUFFMAN_SKIP_BITS]) ;
+
 /**
  *  Encode DC or AC value to a buffer pointed by destination, starting at bit pointer p.
  */
 void encode_huffman_dc_value (uint16_t amplitude, uint8_t* destination, int* p) ;
 void encode_huffman_ac_value (uint16_t amplitude, uint8_t run_length, uint8_t* destination, int* p) ;
 
+/**
+ *  Number of bits encode_huffman_ac_value writes for an amplitude of size bits
+ *  after run_length zeroes, the code and the amplitude together.
+ */
+uint8_t huffman_ac_code_length (uint8_t run_length, uint8_t size) ;
+
+/**
+ *  Upper bound of the bits encoding a block takes, the DC difference and the
+ *  AC coefficients of transformed 8-bit samples quantized with steps in zig
+ *  zag order. The AC coefficients are limited together by the energy the
+ *  samples of a block can have, not each by its largest value alone.
+ *  NULL for steps of 1.
+ */
+int huffman_block_bound (const uint16_t* /* steps */) ;
+
 /**
  *  Destroy a Huffman tree freeing memory from all child nodes.
  */
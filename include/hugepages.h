@@ -0,0 +1,43 @@
+/** ------------------------------------------------------------------------------------
+ *  File: hugepages.h
+ *  Description: Allocation of frame sized buffers on 2 MB pages to cut dTLB misses.
+ *  ------------------------------------------------------------------------------------ */
+#ifndef _HUGEPAGES_H
+#define _HUGEPAGES_H
+
+#include <stddef.h>
+
+#define HUGEPAGES_NONE     -1 // nothing allocated yet
+#define HUGEPAGES_SMALL     0 // regular pages
+#define HUGEPAGES_MADVISE   1 // transparent huge pages requested with madvise
+#define HUGEPAGES_HUGETLB   2 // pages reserved in the huge page pool, MAP_HUGETLB
+
+#define HUGEPAGE_SIZE       (2 << 20)
+
+/**
+ *  Allocate size bytes of zeroed memory aligned to HUGEPAGE_SIZE, from the
+ *  reserved huge page pool if it has pages left, otherwise as transparent
+ *  huge pages if the kernel allows them and otherwise on regular pages.
+ *  Meant for buffers of a frame or more, the size is rounded up to whole
+ *  huge pages.
+ *  Returns NULL on failure.
+ */
+void* hugepages_alloc (size_t /* size */) ;
+
+/**
+ *  Free memory of size bytes allocated with hugepages_alloc. NULL is ignored.
+ */
+void hugepages_free (void* /* memory */, size_t /* size */) ;
+
+/**
+ *  Returns the HUGEPAGES_* mode of the allocations made so far, the lowest
+ *  one if they differ, or HUGEPAGES_NONE.
+ */
+int hugepages_mode () ;
+
+/**
+ *  Returns a name of mode for logs.
+ */
+const char* hugepages_mode_name (int /* mode */) ;
+
+#endif /* _HUGEPAGES_H */
@@ -14,6 +14,44 @@
 
 #define JPEG_HEADER_SIZE    16
 #define JPEG_BLOCK_SIZE      8
+#define JPEG_DECODE_PADDING 256 // readable bytes past the end of a frame the decoder may look at
+
+/* codec options, see jpeg_set_option */
+#define JPEG_OPTION_PIN_THREADS  1 // pin worker threads to cores (0 / 1)
+#define JPEG_OPTION_NUMA_NODE    2 // run the workers on a NUMA node, with the buffers they write (-1 = any)
+#define JPEG_OPTION_IDCT         3 // inverse transform used when decoding, JPEG_IDCT_*
+#define JPEG_OPTION_SIMD         4 // highest instruction set the kernels may use, JPEG_SIMD_*
+#define JPEG_OPTION_SCALE        5 // decode to 1 / value of the size: 1 (default), 2, 4 or 8,
+                                   // with JPEG_IDCT_FLOAT only
+#define JPEG_OPTION_QUALITY      6 // quantization of libjpeg quality 1 - 100, 0 for the default table
+                                   // shared with the other codecs; encoder and decoder must agree.
+#define JPEG_OPTION_RDO          7 // rate-distortion optimized (trellis) quantization when encoding (0 / 1),
+                                   // several times slower, decodable by every decoder
+#define JPEG_OPTION_FORMAT       8 // pixel layout jpeg_decompress writes, JPEG_FORMAT_*
+#define JPEG_OPTION_INPUT_FORMAT 9 // pixel layout jpeg_compress reads, JPEG_FORMAT_UYVY, _RGB24 or _BGRA
+
+#define JPEG_IDCT_FLOAT          0 // floating point Arai, Agui & Nakajima (default)
+#define JPEG_IDCT_INT            1 // libjpeg islow fixed point, same pixels from the std (C and AVX2) and OpenCL backends
+
+#define JPEG_SIMD_NONE           0 // portable C kernels only
+#define JPEG_SIMD_SSE41          1
+#define JPEG_SIMD_AVX2           2
+#define JPEG_SIMD_BEST           3 // default, the best kernels the CPU supports are picked at jpeg_init
+
+#define JPEG_FORMAT_UYVY         0 // packed 4:2:2, U Y V Y (default)
+#define JPEG_FORMAT_I422         1 // planar 4:2:2, the Y plane then the half width U and V planes
+#define JPEG_FORMAT_NV16         2 // semi-planar 4:2:2, the Y plane then a plane of interleaved U V
+#define JPEG_FORMAT_RGB24        3 // packed R G B, BT.601 studio swing like the fragment shader
+#define JPEG_FORMAT_RGBA         4 // packed R G B A with A = 255
+#define JPEG_FORMAT_BGRA         5 // packed B G R A, encoder input only, A is ignored
+
+/**
+ *  Set a codec option, before jpeg_init or between frames. The placement
+ *  of the worker threads is read by jpeg_init and can not change after it.
+ *  Returns non-zero value if the option is not supported, or can not be
+ *  changed after jpeg_init.
+ */
+int jpeg_set_option (int /* option */, int /* value */) ;
 
 /**
  *  Init JPEG compression and decompression.
@@ -27,25 +65,90 @@ int jpeg_init (int w, int h, GLuint /* texture */) ;
 void jpeg_deinit () ;
 
 /**
- *  Encode data to destination.
+ *  Most bytes jpeg_compress writes for a frame of w x h at quality, as
+ *  JPEG_OPTION_QUALITY, whatever the content of the frame.
+ *  Returns 0 for a quality the backend can not encode at; the asm and hw
+ *  backends only have the default table, quality 0.
+ */
+size_t jpeg_compress_bound (int w, int h, int /* quality */) ;
+
+/**
+ *  Encode data in the layout of JPEG_OPTION_INPUT_FORMAT to destination.
+ *  destination needs to be zeroed and hold jpeg_compress_bound bytes for the
+ *  current quality.
  *  Returns size of compressed data. A zero value indicates
  *  an error occurred.
  */
 int jpeg_compress (unsigned char* data, unsigned char* destination) ;
 
+/**
+ *  Encode like jpeg_compress to a zeroed destination of capacity bytes.
+ *  The size is checked once per row of blocks, keeping room for the longest
+ *  coding of a row, so a frame may be refused within that much of capacity.
+ *  Returns size of compressed data, or zero if it does not fit in which case
+ *  destination needs to be zeroed again.
+ */
+int jpeg_compress_bounded (unsigned char* data, unsigned char* destination, size_t /* capacity */) ;
+
 /**
  *  Compress data in the current texture to destination buffer.
  */
 int jpeg_compress_from_texture (GLuint texture, unsigned char* destination) ;
 
 /**
- *  Decode data into destination.
- *  Returns non-zero value on error.
+ *  Decode data into destination in the layout of JPEG_OPTION_FORMAT, scaled
+ *  down by JPEG_OPTION_SCALE. It therefore holds 2 * (w / scale) * (h / scale)
+ *  bytes for the YUV formats, 3 * or 4 * for RGB24 and RGBA.
+ *  data holds a frame of size bytes followed by JPEG_DECODE_PADDING readable
+ *  bytes of any value, as do the data of the other decode functions. The
+ *  input left is checked once per block rather than per bit, the padding
+ *  covers what one block reads however corrupt, so a truncated or corrupt
+ *  frame is refused without reading out of bounds.
+ *  Returns non-zero value on error, the destination is then partly written.
  */
 int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destination) ;
 
+/**
+ *  Decode data like jpeg_decompress into planes owned by the caller, such as
+ *  the data of an AVFrame or a mapped GL buffer, without an intermediate copy.
+ *  Row i of plane k starts at planes[k] + i * pitches[k]: planes[0] is the
+ *  frame of the packed formats and the Y plane of the others, planes[1] and
+ *  [2] U and V of I422, and planes[1] the UV plane of NV16. Unused planes
+ *  may be NULL.
+ *  Not provided by the hw backend.
+ *  Returns non-zero value on error.
+ */
+int jpeg_decompress_planes (unsigned char* data, size_t size, unsigned char* const planes[3], const int pitches[3]) ;
+
+/**
+ *  Called by jpeg_decompress_strips with every decoded strip of lines rows
+ *  starting at row y of the frame. The strip is laid out like a frame of
+ *  lines rows in the output format and is only valid during the call.
+ */
+typedef void (*jpeg_strip_callback) (const unsigned char* /* strip */, int /* y */, int /* lines */, void* /* user */);
+
+/**
+ *  Decode data like jpeg_decompress, but one strip of 8 rows (8 / scale
+ *  with JPEG_OPTION_SCALE) at a time, passing each one to callback as soon
+ *  as all its channels are decoded, on the calling thread.
+ *  Not provided by the hw backend.
+ *  Returns non-zero value on error or if callback is NULL.
+ */
+int jpeg_decompress_strips (unsigned char* data, size_t size, jpeg_strip_callback /* callback */, void* /* user */) ;
+
+/**
+ *  Decode only the DC coefficients of data into destination, a thumbnail of
+ *  1/8 the size (240x135 for 1080p) in the JPEG_OPTION_FORMAT holding the
+ *  average of every block. The AC coefficients are skipped without being decoded.
+ *  Not provided by the hw backend.
+ *  Returns non-zero value on error.
+ */
+int jpeg_decode_dc_only (unsigned char* data, size_t size, unsigned char* destination) ;
+
 /**
  *  Decompress data and load it to OpenGL texture, ready for rendering.
+ *  Requires JPEG_FORMAT_UYVY.
+ *  Returns non-zero value on error.
  */
 int jpeg_decompress_to_texture (unsigned char* data, size_t size, GLuint texture) ;
 
@@ -0,0 +1,123 @@
+/** ------------------------------------------------------------------------------------
+ *  File: mjpg.h
+ *  Description: Indexed container of compressed frames, memory mapped for playback.
+ *
+ *  Layout, integers in host byte order (little endian on x86):
+ *      page 0      struct mjpg_header
+ *      pages       frame payloads, each starting on a page of its own
+ *      pages       the frame table, header.frames struct mjpg_frame entries,
+ *                  padded with zeroes to a whole page
+ *  The table follows the payloads so frames can be written as they come,
+ *  the header is written last. Whole pages follow every payload, so a frame
+ *  decodes in place with the padding of JPEG_DECODE_PADDING.
+ *  ------------------------------------------------------------------------------------ */
+#ifndef _MJPG_H
+#define _MJPG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MJPG_MAGIC          "MJPGIDX1"
+#define MJPG_VERSION        1
+#define MJPG_ALIGN          4096                // of the payloads and the table
+#define MJPG_CHECKSUMS      (1 << 0)            // flag, the frames have a CRC-32C
+#define MJPG_NO_TIMESTAMP   INT64_MIN
+
+struct mjpg_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;     // MJPG_* flags
+    uint32_t width;
+    uint32_t height;
+    uint64_t frames;
+    uint64_t table;     // offset of the frame table
+};
+
+struct mjpg_frame
+{
+    uint64_t offset;    // of the payload, a multiple of MJPG_ALIGN
+    uint32_t size;      // of the payload
+    uint32_t checksum;  // CRC-32C of the payload with MJPG_CHECKSUMS, else 0
+    int64_t  timestamp; // presentation time in microseconds or MJPG_NO_TIMESTAMP
+    uint8_t  quality;   // JPEG_OPTION_QUALITY the frame was encoded with, 0 if fixed
+    uint8_t  reserved[7];
+};
+
+/**
+ *  A container being written.
+ */
+typedef struct
+{
+    FILE*              fp;
+    uint32_t           flags;
+    uint32_t           width;
+    uint32_t           height;
+    uint64_t           frames;
+    uint64_t           allocated;
+    struct mjpg_frame* table;
+}
+mjpg_writer;
+
+/**
+ *  A container mapped for reading. The frames are at base + table[i].offset.
+ */
+typedef struct
+{
+    uint8_t*                  base;
+    size_t                    length;
+    const struct mjpg_header* header;
+    const struct mjpg_frame*  table;
+}
+mjpg_video;
+
+/**
+ *  Create the container path for frames of width x height, flags MJPG_CHECKSUMS
+ *  or 0.
+ *  Returns non-zero on error.
+ */
+int mjpg_create (mjpg_writer* /* writer */, const char* /* path */, int /* width */, int /* height */, uint32_t /* flags */) ;
+
+/**
+ *  Append a frame of size bytes with its timestamp in microseconds and the
+ *  quality it was encoded with.
+ *  Returns non-zero on error.
+ */
+int mjpg_write (mjpg_writer* /* writer */, const uint8_t* /* data */, size_t /* size */, int64_t /* timestamp */, int /* quality */) ;
+
+/**
+ *  Write the frame table and the header and close the container.
+ *  Returns non-zero on error, the container is then unusable.
+ */
+int mjpg_finish (mjpg_writer* /* writer */) ;
+
+/**
+ *  Map the container path read-only and check the header and every entry of
+ *  the table once, so frames are read with no further checks or syscalls.
+ *  Returns non-zero if it cannot be mapped or is not a valid container.
+ */
+int mjpg_open (mjpg_video* /* video */, const char* /* path */) ;
+
+/**
+ *  Unmap a container opened with mjpg_open.
+ */
+void mjpg_close (mjpg_video* /* video */) ;
+
+/**
+ *  Returns frame i of video and sets size, followed by the padding the
+ *  decoder needs. i must be below video->header->frames.
+ */
+static inline uint8_t* mjpg_frame (const mjpg_video* video, uint64_t i, size_t* size)
+{
+    *size = video->table[i].size;
+    return video->base + video->table[i].offset;
+}
+
+/**
+ *  Returns non-zero if the container has checksums and frame i does not
+ *  match its own.
+ */
+int mjpg_verify (const mjpg_video* /* video */, uint64_t /* i */) ;
+
+#endif /* _MJPG_H */
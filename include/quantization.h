@@ -0,0 +1,44 @@
+/** ------------------------------------------------------------------------------------
+ *  File: quantization.h
+ *  Description: Quality scaled quantization tables and the reciprocals the
+ *               encoder quantizes with.
+ *  ------------------------------------------------------------------------------------ */
+#ifndef _QUANTIZATION_H
+#define _QUANTIZATION_H
+
+#include <stdint.h>
+
+#define QUANTIZATION_LUMA      0
+#define QUANTIZATION_CHROMA    1
+
+#define QUANTIZATION_RECIPROCAL 0 // rows of the divisor tables
+#define QUANTIZATION_CORRECTION 1
+#define QUANTIZATION_SCALE      2
+#define QUANTIZATION_SHIFT      3
+
+/**
+ *  Build the quantization table of component (QUANTIZATION_LUMA or _CHROMA)
+ *  by scaling the tables of the JPEG standard (Annex K) like libjpeg does:
+ *  quality 50 is the standard table, 100 all ones and 1 the coarsest.
+ *  quality is clamped to 1..100, but 0 gives the default table of the codecs
+ *  for both components, the one the asm and hw backends always use.
+ */
+void quantization_table (int /* quality */, int /* component */, uint16_t table[64]) ;
+
+/**
+ *  Compute the divisors that quantize by table with an unsigned 16-bit
+ *  multiply instead of a division, rounding to nearest:
+ *
+ *      q = ((|c| + correction) * reciprocal) >> shift
+ *
+ *  and for SIMD the shift is replaced by a second multiply-high,
+ *
+ *      q = mulhi (mulhi (|c| + correction, reciprocal), scale)
+ *
+ *  which gives the same result. Exact for |c| < 2^15.
+ *  Returns non-zero if the table has steps of 1 or 2, which need a shift of
+ *  16 bits or less and therefore can not use the multiply-high form.
+ */
+int quantization_divisors (const uint16_t table[64], uint16_t divisors[4][64]) ;
+
+#endif /* _QUANTIZATION_H */
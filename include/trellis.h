@@ -0,0 +1,31 @@
+/** ------------------------------------------------------------------------------------
+ *  File: trellis.h
+ *  Description: Rate-distortion optimized (trellis) quantization of the encoder.
+ *  ------------------------------------------------------------------------------------ */
+#ifndef _TRELLIS_H
+#define _TRELLIS_H
+
+#include <stdint.h>
+
+/**
+ *  Read the code lengths of the AC Huffman table. Must be called before
+ *  trellis_quantize.
+ */
+void trellis_init () ;
+
+/**
+ *  Quantize a block of transformed coefficients in place with the steps q.
+ *  The DC coefficient is rounded. Every AC coefficient is rounded, lowered by
+ *  one step or zeroed, whichever choice over the block in zig zag order gives
+ *  the lowest squared error + lambda * bits with the actual lengths of the
+ *  run length codes. The result is an ordinary quantized block for any decoder.
+ */
+void trellis_quantize (int16_t* block, const float* q, float lambda) ;
+
+/**
+ *  Lambda trading squared error for bits around the operating point of the
+ *  quantization steps q.
+ */
+float trellis_lambda (const float* q) ;
+
+#endif /* _TRELLIS_H */
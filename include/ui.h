@@ -23,6 +23,17 @@ void deinit_ui () ;
  */
 void load_texture (unsigned char* /* data */, int /* width */, int /* height */) ;
 
+/**
+ *  Map the texture buffer of a new width x height UYVY frame for writing.
+ *  Returns NULL if the buffer can not be mapped, load_texture is used then.
+ */
+unsigned char* map_texture (int /* width */, int /* height */) ;
+
+/**
+ *  Unmap the texture buffer after the frame has been written to it.
+ */
+void unmap_texture () ;
+
 /**
  *  Retrieve current GL texture.
  */
@@ -11,6 +11,13 @@
  */
 int write_bits (uint16_t symbol, uint8_t size, uint8_t* buffer, int* p) ;
 
+/**
+ *  Append the first n bits of source to buffer at position p, like write_bits
+ *  the buffer needs to be zero past p and so does source past n bits.
+ *  Increments p to n when done.
+ */
+void append_bits (const uint8_t* source, int n, uint8_t* buffer, int* p) ;
+
 /**
  *  Read a value that has is the next size bits in buffer starting
  *  from bit pointer p;
@@ -38,9 +45,25 @@ void print_coefs (float block[8][8]) ;
 void print_coefs_p (float* block);
 
 /**
- *  Load a file contents into buffer.
+ *  Load a file contents into buffer, followed by a zero and the
+ *  JPEG_DECODE_PADDING zeroed bytes the decoder may read past a frame.
  *  The buffer needs to manually be freed later.
  */
 int load_file (const char* /* file path */, void** /* destination */, size_t* /* size */ );
 
+/**
+ *  Map a file read-only to view without reading or copying it, with at least
+ *  JPEG_DECODE_PADDING zero bytes after it so a frame decodes straight from
+ *  the view. size is the size of the file. The pages are read ahead for a
+ *  sequential pass.
+ *  The view needs to be released with unmap_file.
+ *  Returns non-zero on error.
+ */
+int map_file (const char* /* file path */, void** /* view */, size_t* /* size */ );
+
+/**
+ *  Release a view of size bytes from map_file. NULL is ignored.
+ */
+void unmap_file (void* /* view */, size_t /* size */ );
+
 #endif /* _UTILS_H */
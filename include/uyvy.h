@@ -0,0 +1,66 @@
+#ifndef _UYVY_H
+#define _UYVY_H
+
+#include <stdint.h>
+
+/**
+ *  SSE4.1 kernels moving data between frames and 8x8 blocks.
+ *  Only available on CPUs supporting SSE4.1.
+ */
+
+/* BT.601 studio swing YCbCr to RGB in 8-bit fixed point, as in the fragment shader:
+ * R = (Y' + RV V' + 128) >> 8, G = (Y' + GU U' + GV V' + 128) >> 8, B = (Y' + BU U' + 128) >> 8
+ * with Y' = YUV_RGB_Y (Y - 16), U' = U - 128 and V' = V - 128 */
+#define YUV_RGB_Y    298
+#define YUV_RGB_RV   409
+#define YUV_RGB_GU  -100
+#define YUV_RGB_GV  -208
+#define YUV_RGB_BU   516
+
+/* and back, with the chroma of two horizontally neighbouring pixels from the sums of their R, G and B:
+ * Y = ((YR R + YG G + YB B + 128) >> 8) + 16, U = ((UR Rs + UG Gs + UB Bs + 256) >> 9) + 128 and V alike */
+#define RGB_YUV_YR    66
+#define RGB_YUV_YG   129
+#define RGB_YUV_YB    25
+#define RGB_YUV_UR   -38
+#define RGB_YUV_UG   -74
+#define RGB_YUV_UB   112
+#define RGB_YUV_VR   112
+#define RGB_YUV_VG   -94
+#define RGB_YUV_VB   -18
+
+/**
+ *  Deinterleave a strip of 8 rows of a UYVY frame of width pixels into the
+ *  width / 8 blocks of Y and width / 16 blocks of U and of V, each block
+ *  64 consecutive 16-bit samples, in one pass over the strip.
+ */
+void uyvy_deinterleave_sse41 (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V) ;
+
+/**
+ *  Convert a strip of 8 rows of packed RGB24 or BGRA, alpha ignored, to the
+ *  blocks of Y, U and V like uyvy_deinterleave_sse41, with RGB_YUV_* and
+ *  chroma subsampled horizontally, in one pass over the strip.
+ */
+void rgb24_deinterleave_sse41 (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V) ;
+void bgra_deinterleave_sse41  (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V) ;
+
+/**
+ *  Store a decoded strip of 8 rows, the 2n blocks of luma pixels Y and the
+ *  n blocks of U and of V, each block 64 consecutive bytes, to the rows of
+ *  the output planes, strides bytes apart:
+ *
+ *      uyvy   packed UYVY in planes[0]
+ *      i422   Y, U and V in planes[0], [1] and [2]
+ *      nv16   Y in planes[0] and interleaved UV in planes[1]
+ *      rgb24  packed RGB in planes[0], converted as YUV_RGB_*
+ *      rgba   packed RGBA with opaque alpha in planes[0]
+ *
+ *  Each row of 16 luma and 8 of each chroma is stored in one pass.
+ */
+void uyvy_store_sse41  (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3]) ;
+void i422_store_sse41  (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3]) ;
+void nv16_store_sse41  (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3]) ;
+void rgb24_store_sse41 (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3]) ;
+void rgba_store_sse41  (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3]) ;
+
+#endif
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+
+
+/**
+ *  Parse a kernel CPU list, e.g. "0-7,16-23", into cpus.
+ *  Returns number of CPUs parsed.
+ */
+static int parse_cpulist (FILE* fp, int* cpus, int n)
+{
+    int count = 0;
+    int first, last;
+    char sep;
+
+    while (count < n && fscanf (fp, "%d", &first) == 1)
+    {
+        last = first;
+        sep  = fgetc (fp);
+        if (sep == '-')
+        {
+            if (fscanf (fp, "%d", &last) != 1)
+                break;
+            sep = fgetc (fp);
+        }
+        for (int cpu = first; cpu <= last && count < n; cpu ++)
+            cpus[count ++] = cpu;
+        if (sep != ',')
+            break;
+    }
+    return count;
+}
+
+
+int affinity_cpus (int node, int* cpus, int n)
+{
+    if (node == AFFINITY_ANY_NODE)
+    {
+        int count = 0;
+        cpu_set_t set;
+        if (sched_getaffinity (0, sizeof (cpu_set_t), &set) != 0)
+            return 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE && count < n; cpu ++)
+            if (CPU_ISSET (cpu, &set))
+                cpus[count ++] = cpu;
+        return count;
+    }
+
+    char path[64];
+    snprintf (path, sizeof (path), NODE_CPULIST, node);
+    FILE* fp = fopen (path, "r");
+    if (fp == NULL)
+        return 0;
+    int count = parse_cpulist (fp, cpus, n);
+    fclose (fp);
+    return count;
+}
+
+
+int affinity_pin (pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET  (cpu, &set);
+    return pthread_setaffinity_np (thread, sizeof (cpu_set_t), &set);
+}
+
+
+int affinity_bind (pthread_t thread, const int* cpus, int n)
+{
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (int i = 0; i < n; i ++)
+        CPU_SET (cpus[i], &set);
+    return pthread_setaffinity_np (thread, sizeof (cpu_set_t), &set);
+}
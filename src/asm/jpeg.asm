@@ -30,7 +30,6 @@ global decompress_red
 
 %define     block_size  0x100               ; block size in bytes, 64 x 4 (size of float = 4)
 %define     row_size    0x20                ; row, in block, size, 8 x 4 (size of float = 4)
-%define     max_byte    0xFF
 %define     norm        1024
 
 %define     y_mask      0xFF00FF00FF00FF00
@@ -104,31 +103,6 @@ setup:
     ret
 
 
-; Round a single precision float point to byte.
-; if [ v > 255 ];
-;   v = 255
-; else if [ v < 0 ];
-;   v = 0
-; else
-;   v = v
-; XMM0 contains the float in its 4 least significant bytes.
-; RAX will contain the byte when returned.
-roundfloat:
-    cvttss2si   rax, xmm0           ; convert float to int
-roundint:
-    mov         rbx, max_byte
-    mov         rcx, 0
-    ; test signed (negativ) value
-    test        rax, rax
-    cmovs       rax, rcx
-    js          doneround
-    ; test larger than max byte (255)
-    cmp         rax, max_byte
-    cmovg       rax, rbx
-doneround:
-    ret
-
-
 ; Extract and compress a luminance block stored
 ; to a supplied 16-bit integer array pointer
 ; RDI points to source byte array
@@ -232,35 +206,34 @@ __debug__:
 ; to a block of 8x8 bytes and store them correctly interleaved in memory
 ; RDI points to the 16bit integers
 ; RSI points to destination byte buffer.
+; EDX holds the bytes between the rows of the destination.
 decompress_luminance:
     push        rbx
+    movsxd      rdx, edx
+    push        rdx
     call        decompress_block
+    pop         r10                 ; row pitch in bytes
     ; convert and store the 8x8 floats as bytes into memory
     mov         rdi, [block]
     mov         r8, 8               ; 8 rows / block
     add         rsi, 1              ; offset
-    mov         r10, [width]        ; UYVY so we have
-    shl         r10, 1              ; width in bytes = width in pixels x 2
-    sub         r10, 0x10
 __store_luminance_row__:
-    mov         r9, 2               ; 2 x 4 floats / row
-__store_luminance_halfrow__:
-    ; load 4 floats
-    movdqa      xmm0, [rdi]
-    mov         r11, 4              ; 4 floats in a double qword
-__store_luminance_byte__:
-    ; round each and store
-    call        roundfloat          ; round float to byte
-    mov         [rsi], al           ; store byte
-    psrldq      xmm0, 4             ; shift right to next float
-    add         rsi, 2
-    dec         r11
-    jnz         __store_luminance_byte__
-    ; half-row done
-    add         rdi, 0x10
-    dec         r9
-    jnz         __store_luminance_halfrow__
+    ; truncate a row of floats to ints and saturate them to bytes
+    cvttps2dq   xmm0, [rdi]
+    cvttps2dq   xmm1, [rdi + 0x10]
+    packssdw    xmm0, xmm1
+    packuswb    xmm0, xmm0
+    ; store to every other byte
+    pextrb      [rsi], xmm0, 0
+    pextrb      [rsi + 2], xmm0, 1
+    pextrb      [rsi + 4], xmm0, 2
+    pextrb      [rsi + 6], xmm0, 3
+    pextrb      [rsi + 8], xmm0, 4
+    pextrb      [rsi + 10], xmm0, 5
+    pextrb      [rsi + 12], xmm0, 6
+    pextrb      [rsi + 14], xmm0, 7
     ; row done
+    add         rdi, row_size
     add         rsi, r10
     dec         r8
     jnz         __store_luminance_row__
@@ -273,36 +246,35 @@ __store_luminance_byte__:
 ; and store them into memory accordingly to channel.
 ; RDI: source 16-bit block in memory
 ; RSI: destination memory address
+; EDX: bytes between the rows of the destination
 decompress_red:
     add         rsi, 2
 decompress_blue:
     push        rbx
+    movsxd      rdx, edx
+    push        rdx
     call        decompress_block
+    pop         r10                 ; row pitch in bytes
     ; convert and store the 8x8 floats as bytes into memory
     mov         rdi, [block]
     mov         r8, 8               ; 8 rows / block
-    mov         r10, [width]        ; UYVY so we have
-    shl         r10, 1              ; width in bytes = width in pixels x 2
-    sub         r10, 0x20
 __store_color_row__:
-    mov         r9, 2               ; 2 x 4 floats / row
-__store_color_halfrow__:
-    ; load 4 floats
-    movdqa      xmm0, [rdi]
-    mov         r11, 4              ; 4 floats in a double qword
-__store_color_byte__:
-    ; round each and store
-    call        roundfloat          ; round float to byte
-    mov         [rsi], al           ; store byte
-    psrldq      xmm0, 4             ; shift right to next float
-    add         rsi, 4
-    dec         r11
-    jnz         __store_color_byte__
-    ; half-row done
-    add         rdi, 0x10
-    dec         r9
-    jnz         __store_color_halfrow__
+    ; truncate a row of floats to ints and saturate them to bytes
+    cvttps2dq   xmm0, [rdi]
+    cvttps2dq   xmm1, [rdi + 0x10]
+    packssdw    xmm0, xmm1
+    packuswb    xmm0, xmm0
+    ; store to every fourth byte
+    pextrb      [rsi], xmm0, 0
+    pextrb      [rsi + 4], xmm0, 1
+    pextrb      [rsi + 8], xmm0, 2
+    pextrb      [rsi + 12], xmm0, 3
+    pextrb      [rsi + 16], xmm0, 4
+    pextrb      [rsi + 20], xmm0, 5
+    pextrb      [rsi + 24], xmm0, 6
+    pextrb      [rsi + 28], xmm0, 7
     ; row done
+    add         rdi, row_size
     add         rsi, r10
     dec         r8
     jnz         __store_color_row__
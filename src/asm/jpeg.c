@@ -1,6 +1,9 @@
 #include "jpeg/jpeg.h"
 #include "huffman.h"
+#include "decode.h"
 #include "utils.h"
+#include "hugepages.h"
+#include "quantization.h"
 #include "ui.h"
 #include <stdio.h>
 #include <stdint.h>
@@ -9,6 +12,7 @@
 #include <string.h>
 #ifdef MULTITHREAD
 #include "thread_pool.h"
+#include "affinity.h"
 #include <unistd.h>
 #endif
 
@@ -22,12 +26,23 @@
 #define DECODE_HUFFMAN_DC(buffer, p) decode_huffman_value (huffman_dc_tree, buffer, p)
 
 
+// no block starts past the end of the stream, the padding covers what one reads
 #define DECOMPRESS(func, ptr, block) \
-    memset (block, 0, block_byte_size);\
-    decode (data, &p, block);\
-    block[0] += prev_dc;\
-    prev_dc = block[0];\
-    func (compressed_block, destination + y * w + x);
+    {\
+        int last;\
+        if (p > end || (last = decode (data, &p, block)) < 0)\
+            goto corrupt;\
+        block[0] += prev_dc;\
+        prev_dc = block[0];\
+        func (compressed_block, destination + y * w + x, w);\
+        clear_block (block, last);\
+    }
+
+
+// checked before every row of blocks so the bits written need no checks
+#define ROW_FITS() \
+    if (p + row_bits > room) \
+        return 0;
 
 
 #define COMPRESS(func, ptr, block) \
@@ -40,6 +55,7 @@
 
 static struct huffman_tree_node* huffman_ac_tree;
 static struct huffman_tree_node* huffman_dc_tree;
+static uint8_t                   huffman_ac_skip[1 << HUFFMAN_SKIP_BITS];
 
 /* specify zig zag order to do entropy encoding in */
 static uint8_t zigzag[JPEG_BLOCK_SIZE * JPEG_BLOCK_SIZE][2] =
@@ -59,6 +75,14 @@ static int      width,
 
 static uint8_t* buffer;
 
+// the transform buffers of the assembly and a block of coefficients, those
+// of the calling thread in the threaded version
+static float*   block_coefs,
+            *   block_coefs_transformed;
+static int16_t* compressed_block;
+
+static int      block_bits; // most bits encode writes for a block, see block_bound
+
 
 /**
  *  Assembly functions
@@ -70,9 +94,10 @@ extern void compress_luminance   (uint8_t*, int16_t*);
 extern void compress_red         (uint8_t*, int16_t*);
 extern void compress_blue        (uint8_t*, int16_t*);
 
-extern void decompress_luminance (int16_t*, uint8_t*);
-extern void decompress_red       (int16_t*, uint8_t*);
-extern void decompress_blue      (int16_t*, uint8_t*);
+// the last argument is the bytes between the rows of the destination
+extern void decompress_luminance (int16_t*, uint8_t*, int);
+extern void decompress_red       (int16_t*, uint8_t*, int);
+extern void decompress_blue      (int16_t*, uint8_t*, int);
 
 
 /**
@@ -88,6 +113,7 @@ static void huffman_init ()
     huffman_dc_tree->children[0] = huffman_dc_tree->children[1] = NULL;
     create_huffman_ac_tree (huffman_ac_tree);
     create_huffman_dc_tree (huffman_dc_tree);
+    create_huffman_ac_skip_table (huffman_ac_skip);
 }
 
 /**
@@ -136,12 +162,16 @@ static inline void encode (int16_t* block, uint8_t* destination, int* p)
 }
 
 /**
- *  Decode entropy data.
+ *  Decode entropy data into a zeroed block.
+ *  Returns the zig zag index of the last nonzero coefficient, or -1 on a
+ *  corrupt block which is left zeroed.
  */
-static inline void decode (uint8_t* data, int* p, int16_t* block)
+static inline int decode (uint8_t* data, int* p, int16_t* block)
 {
     // decode DC coefficient
     uint8_t  symbol    = DECODE_HUFFMAN_DC (data, p);
+    if (symbol == HUFFMAN_INVALID)
+        return -1;
     uint16_t amplitude = read_value (data, p, symbol);
     // check if it was a negative value
     if ((amplitude & (1 << (symbol - 1))) == 0)
@@ -149,38 +179,69 @@ static inline void decode (uint8_t* data, int* p, int16_t* block)
     block[0] = amplitude;
 
     // fill rest of block
-    int i = 1;
+    int i = 1, last = 0;
     uint8_t run, size;
     while ((symbol = DECODE_HUFFMAN_AC (data, p)) != EOB)
     {
         run  = symbol >> 4;
         size = symbol & 0xF;
         i   += run; // skip zeroes
+        if (corrupt_code (i, symbol))
+        {
+            clear_block (block, last);
+            return -1;
+        }
         if (size > 0)
         {
             amplitude = read_value (data, p, size);
             if ((amplitude & (1 << (size - 1))) == 0) // handle negative values
                 amplitude = ~((~amplitude) & ~(0xFFFF << size)) + 1;
             block[(zigzag[i][1] << 3) + zigzag[i][0]] = amplitude;
-            i ++;
+            last = i ++;
         }
     }
+    return last;
 }
 
 
-#ifndef MULTITHREAD /* single threaded version */
+/**
+ *  Most bits encode writes for a block, quantized with the table of jpeg.asm
+ *  which is the default one of quantization_table.
+ */
+static int block_bound ()
+{
+    uint16_t table[BLOCK_TSIZE], steps[BLOCK_TSIZE];
 
-static float*   block_coefs,
-            *   block_coefs_transformed;
-static int16_t* compressed_block;
+    quantization_table (0, QUANTIZATION_LUMA, table);
+    for (int i = 0; i < BLOCK_TSIZE; i ++)
+        steps[i] = table[decode_zigzag[i]];
+    return huffman_block_bound (steps);
+}
+
+/**
+ *  Most bytes of a frame of w x h with blocks of at most bits bits.
+ */
+static size_t frame_bound (int w, int h, int bits)
+{
+    // luma, and U and V together
+    size_t frame_bits = 2 * (size_t) (w >> 3) * (h >> 3) * bits;
+    return JPEG_HEADER_SIZE + ((frame_bits + 7) >> 3) + 2;
+}
+
+
+#ifndef MULTITHREAD /* single threaded version */
 
 int jpeg_init (int w, int h, GLuint texbuf)
 {
     width  = w;
     height = h;
-    buffer = malloc (width * height * 2);
 
-    // allocate buffers
+    // allocate buffers, the frame on huge pages when the system has them
+    if ((buffer = hugepages_alloc (width * height * 2)) == NULL)
+    {
+        fprintf (stderr, "error allocating buffer\n");
+        return 1;
+    }
     if (posix_memalign ((void**) &compressed_block, 16, BLOCK_TSIZE * sizeof (int16_t)) != 0)
     {
         fprintf (stderr, "error allocating buffer\n");
@@ -201,6 +262,7 @@ int jpeg_init (int w, int h, GLuint texbuf)
     setup (w, h, block_coefs, block_coefs_transformed);
     // initialize huffman trees
     huffman_init ();
+    block_bits = block_bound ();
     return 0;
 }
 
@@ -209,87 +271,26 @@ void jpeg_deinit ()
 {
     // free huffman trees
     huffman_deinit ();
-    free (buffer);
+    hugepages_free (buffer, width * height * 2);
     free (block_coefs);
     free (block_coefs_transformed);
     free (compressed_block);
 }
 
 
-int jpeg_compress (unsigned char* data, unsigned char* destination)
-{
-    uint8_t* ptr          = data;
-    int      p            = JPEG_HEADER_SIZE << 3; // bit pointer
-    int      w            = width << 1;
-    int      block_stride = (JPEG_BLOCK_SIZE - 1) * w;
-    int16_t  prev_dc      = 0;
-    int16_t  prev_dc_tmp  = 0;
-    int y, x;
-
-    memset (compressed_block, 0, BLOCK_TSIZE * sizeof (int16_t));
-
-    // compress Y
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
-    {
-        for (x = 0; x < w / 2; x += Y_STRIDE, ptr += Y_STRIDE)
-        {
-            COMPRESS (compress_luminance, ptr, compressed_block)
-        }
-        ptr += w - w / 2 - ((w / 2) % Y_STRIDE);
-    }
-    // reset and write to header size in bits of encoded y blocks
-    memcpy (destination, &p, sizeof (int));
-    ptr = data + w / 2 - ((w / 2) % Y_STRIDE);
-    prev_dc = 0;
-
-    for (y = 0 ; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
-    {
-        for (x = w / 2 - ((w / 2) % Y_STRIDE); x < w; x += Y_STRIDE, ptr += Y_STRIDE)
-        {
-            COMPRESS (compress_luminance, ptr, compressed_block)
-        }
-        ptr += w / 2 - ((w / 2) % Y_STRIDE);
-    }
-    // reset and write to header size in bits of encoded y blocks
-    memcpy (destination + sizeof (int), &p, sizeof (int));
-    ptr = data;
-    prev_dc = 0;
-
-    // compress U
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
-    {
-        for (x = 0; x < w; x += UV_STRIDE, ptr += UV_STRIDE)
-        {
-            COMPRESS (compress_blue, ptr, compressed_block)
-        }
-    }
-    // reset and write to header size in bits of encoded u blocks
-    memcpy (destination + 2 * sizeof (int), &p, sizeof (int));
-    ptr = data;
-    prev_dc = 0;
-
-    // compress V
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
-    {
-        for (x = 0; x < w; x += UV_STRIDE, ptr += UV_STRIDE)
-        {
-            COMPRESS (compress_red, ptr, compressed_block)
-        }
-    }
-    // write to header size in bits of encoded v blocks
-    memcpy (destination + 3 * sizeof (int), &p, sizeof (int));
-    return (p >> 3) + 1;
-}
-
-
 int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destination)
 {
     int     w               = width << 1;
     int     p               = JPEG_HEADER_SIZE << 3;
     size_t  block_byte_size = BLOCK_TSIZE * sizeof (int16_t);
     int16_t prev_dc         = 0;
+    int     start[4], end;
     int y, x;
 
+    if (read_header (data, size, start, &end) != 0)
+        return 1;
+    // shared with the encoder, from here on decode keeps it zeroed
+    memset (compressed_block, 0, block_byte_size);
     for (y = 0; y < height; y += JPEG_BLOCK_SIZE)
     {
         for (x = 0; x < w / 2; x += Y_STRIDE)
@@ -322,16 +323,26 @@ int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destinatio
         }
     }
     return 0;
+
+corrupt:
+    return 1;
 }
 
 
 int jpeg_decompress_to_texture (uint8_t* data, size_t size, GLuint tex)
 {
-    jpeg_decompress (data, size, buffer);
+    if (jpeg_decompress (data, size, buffer) != 0)
+        return 1;
     load_texture (buffer, width, height);
     return 0;
 }
 
+
+int jpeg_set_option (int option, int value)
+{
+    return 1;
+}
+
 #endif /* if not defined MULTITHREAD */
 
 
@@ -346,6 +357,7 @@ int jpeg_decompress_to_texture (uint8_t* data, size_t size, GLuint tex)
         fprintf (stderr, "error allocating buffer in thread\n");\
         return NULL;\
     }\
+    memset (compressed_block, 0, block_byte_size);\
     if (posix_memalign ((void**) &block_coefs, 16, BLOCK_TSIZE * sizeof (float)) != 0)\
     {\
         fprintf (stderr, "error allocating buffer\n");\
@@ -363,13 +375,34 @@ int jpeg_decompress_to_texture (uint8_t* data, size_t size, GLuint tex)
 static pthread_t        thread_y;
 static pthread_t        thread_uv;
 
-static int              running = 1;
+// worker placement
+static int              pin_threads = 0;
+static int              numa_node   = AFFINITY_ANY_NODE;
+static int              cpus[AFFINITY_MAX_CPUS];
+static int              ncpus       = 0;
 
 static thread_pool      y_jobs;
 static thread_pool      finished_y_jobs;
 static thread_pool      uv_jobs;
 static thread_pool      finished_uv_jobs;
 
+static int              stream_start[4]; // where the channels of the frame being decoded start
+static int              stream_end;      // and its bits
+static int              initialised = 0; // the workers are placed, see jpeg_set_option
+
+/**
+ *  Pin the calling worker to a core of its own, or let it run on any CPU of
+ *  the node when only a node is asked for. The frame buffer is first touched
+ *  when the workers decode into it, so its pages are on their node.
+ */
+static void place_worker (int index)
+{
+    if (ncpus > 0 && pin_threads)
+        affinity_pin (pthread_self (), cpus[index % ncpus]);
+    else if (ncpus > 0)
+        affinity_bind (pthread_self (), cpus, ncpus);
+}
+
 /**
  *  Threaded function decompressing Y values.
  */
@@ -379,6 +412,7 @@ static void* decompress_y (void* __not_used__)
     uint8_t* destination        = NULL;
     int      w                  = width << 1;
     int      p                  = JPEG_HEADER_SIZE << 3;
+    int      end                = 0;
     size_t   block_byte_size    = BLOCK_TSIZE * sizeof (int16_t);
     int16_t  prev_dc            = 0;
     int16_t* compressed_block   = NULL;
@@ -386,26 +420,42 @@ static void* decompress_y (void* __not_used__)
          *   block_coefs_transformed;
     thread_args args;
 
+    place_worker (0);
+
     THREAD_SETUP
 
-    while (running)
+    for (;;)
     {
-        // pop new job
+        // pop new job, one without data stops the worker
         if (thread_pool_pop (&y_jobs, &args) == THREAD_POOL_EMPTY)
             continue;
+        if (args.source == NULL)
+            break;
 
-        p = JPEG_HEADER_SIZE << 3;
+        end = stream_end;
         data = args.source;
         destination = args.destination;
+
+        // decompress the left then the right half, each a channel of its own
+        p = stream_start[0];
         prev_dc = 0;
-        // decompress
         for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
-            for (int x = 0; x < w; x += Y_STRIDE)
+            for (int x = 0; x < w / 2; x += Y_STRIDE)
             {
                 DECOMPRESS (decompress_luminance, ptr, compressed_block);
             }
-        // push to finished jobs
-        thread_pool_push (&finished_y_jobs, data, destination);
+        p = stream_start[1];
+        prev_dc = 0;
+        for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
+            for (int x = w / 2 - ((w / 2) % Y_STRIDE); x < w; x += Y_STRIDE)
+            {
+                DECOMPRESS (decompress_luminance, ptr, compressed_block);
+            }
+        // push to finished jobs, a negative bit pointer on a corrupt stream
+        thread_pool_push (&finished_y_jobs, data, destination, 0, 0, 0);
+        continue;
+corrupt:
+        thread_pool_push (&finished_y_jobs, data, destination, 0, 0, -1);
     }
 
     free (compressed_block);
@@ -423,6 +473,7 @@ static void* decompress_uv (void* __not_used__)
     uint8_t* destination        = NULL;
     int      w                  = width << 1;
     int      p                  = 0;
+    int      end                = 0;
     size_t   block_byte_size    = BLOCK_TSIZE * sizeof (int16_t);
     int16_t  prev_dc            = 0;
     int16_t* compressed_block   = NULL;
@@ -431,25 +482,31 @@ static void* decompress_uv (void* __not_used__)
 
     thread_args args;
 
+    place_worker (1);
+
     THREAD_SETUP
 
-    while (running)
+    for (;;)
     {
-        // pop new job
+        // pop new job, one without data stops the worker
         if (thread_pool_pop (&uv_jobs, &args) == THREAD_POOL_EMPTY)
             continue;
+        if (args.source == NULL)
+            break;
 
         data = args.source;
         destination = args.destination;
-        memcpy (&p, data, sizeof (int));
-        prev_dc = 0;
+        end = stream_end;
 
         // decompress
+        p = stream_start[2];
+        prev_dc = 0;
         for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
             for (int x = 0; x < w; x += UV_STRIDE)
             {
                 DECOMPRESS (decompress_blue, ptr, compressed_block);
             }
+        p = stream_start[3];
         prev_dc = 0;
         for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
             for (int x = 0; x < w; x += UV_STRIDE)
@@ -457,8 +514,11 @@ static void* decompress_uv (void* __not_used__)
                 DECOMPRESS (decompress_red, ptr, compressed_block);
             }
 
-        // push to finished jobs
-        thread_pool_push (&finished_uv_jobs, data, destination);
+        // push to finished jobs, a negative bit pointer on a corrupt stream
+        thread_pool_push (&finished_uv_jobs, data, destination, 0, 0, 0);
+        continue;
+corrupt:
+        thread_pool_push (&finished_uv_jobs, data, destination, 0, 0, -1);
     }
 
     free (compressed_block);
@@ -470,67 +530,340 @@ static void* decompress_uv (void* __not_used__)
 int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destination)
 {
     thread_args args;
+    int         ret = 0;
 
-    // push new jobs to decompress threads
-    thread_pool_push (&y_jobs, data, destination);
-    thread_pool_push (&uv_jobs, data, destination);
+    if (read_header (data, size, stream_start, &stream_end) != 0)
+        return 1;
+    // push new jobs to decompress threads, Y and U V being 2 channels each
+    thread_pool_push (&y_jobs, data, destination, 0, 0, 0);
+    thread_pool_push (&uv_jobs, data, destination, 0, 0, 0);
 
     // do something ?
     // this function is blocking but we could make it buffer.
 
     // pop finished job
     thread_pool_pop (&finished_y_jobs, &args);
+    ret |= args.bitp < 0;
     thread_pool_pop (&finished_uv_jobs, &args);
-    return 0;
+    ret |= args.bitp < 0;
+    return ret;
 }
 
 int jpeg_decompress_to_texture (uint8_t* data, size_t size, GLuint tex)
 {
-    jpeg_decompress (data, size, buffer);
+    if (jpeg_decompress (data, size, buffer) != 0)
+        return 1;
     load_texture (buffer, width, height);
     return 0;
 }
 
-int jpeg_compress (uint8_t* source, uint8_t* destination)
-{
-    // not implemented
-    return 0;
-}
-
 
 int jpeg_init (int w, int h, GLuint tex)
 {
     width  = w;
     height = h;
 
-    buffer = malloc (width * height * 2);
+    // on huge pages when the system has them
+    if ((buffer = hugepages_alloc (width * height * 2)) == NULL)
+    {
+        fprintf (stderr, "error allocating buffer\n");
+        return 1;
+    }
+    // for the coding done on the calling thread, the workers set up their own
+    if (posix_memalign ((void**) &compressed_block, 16, BLOCK_TSIZE * sizeof (int16_t)) != 0 ||
+        posix_memalign ((void**) &block_coefs, 16, BLOCK_TSIZE * sizeof (float)) != 0 ||
+        posix_memalign ((void**) &block_coefs_transformed, 16, BLOCK_TSIZE * sizeof (float)) != 0)
+    {
+        fprintf (stderr, "error allocating buffer\n");
+        return 1;
+    }
+    setup (w, h, block_coefs, block_coefs_transformed);
 
     huffman_init ();
+    block_bits = block_bound ();
 
     thread_pool_init (&y_jobs);
     thread_pool_init (&uv_jobs);
     thread_pool_init (&finished_y_jobs);
     thread_pool_init (&finished_uv_jobs);
 
+    // CPUs to place the workers on
+    if (pin_threads || numa_node != AFFINITY_ANY_NODE)
+    {
+        ncpus = affinity_cpus (numa_node, cpus, AFFINITY_MAX_CPUS);
+        if (ncpus == 0)
+            fprintf (stderr, "could not find any CPUs for node %d, threads will not be pinned\n", numa_node);
+    }
+
     // start threads
     pthread_create (&thread_y,  NULL, decompress_y, NULL);
     pthread_create (&thread_uv, NULL, decompress_uv, NULL);
+    initialised = 1;
 
     return 0;
 }
 
+
+int jpeg_set_option (int option, int value)
+{
+    switch (option)
+    {
+        // the workers are placed when they start in jpeg_init
+        case JPEG_OPTION_PIN_THREADS:
+            if (initialised)
+                return 1;
+            pin_threads = value;
+            return 0;
+        case JPEG_OPTION_NUMA_NODE:
+            if (initialised)
+                return 1;
+            numa_node = value;
+            return 0;
+        default:
+            return 1;
+    }
+}
+
 void jpeg_deinit ()
 {
-    running = 0;
+    // stop the workers while the pools are still valid, then free what they use
+    thread_pool_push (&y_jobs,  NULL, NULL, 0, 0, 0);
+    thread_pool_push (&uv_jobs, NULL, NULL, 0, 0, 0);
+    pthread_join (thread_y,  NULL);
+    pthread_join (thread_uv, NULL);
     thread_pool_destroy (&y_jobs);
     thread_pool_destroy (&uv_jobs);
     thread_pool_destroy (&finished_y_jobs);
     thread_pool_destroy (&finished_uv_jobs);
-    pthread_join (thread_y,  NULL);
-    pthread_join (thread_uv, NULL);
     huffman_deinit ();
-    free (buffer);
+    hugepages_free (buffer, width * height * 2);
+    free (block_coefs);
+    free (block_coefs_transformed);
+    free (compressed_block);
+    initialised = 0;
 }
 
 
 #endif /* ifdef MULTITHREAD */
+
+
+size_t jpeg_compress_bound (int w, int h, int quality)
+{
+    // the quantization is fixed to the default table
+    if (quality != 0)
+        return 0;
+    return frame_bound (w, h, block_bound ());
+}
+
+
+int jpeg_compress (unsigned char* data, unsigned char* destination)
+{
+    return jpeg_compress_bounded (data, destination, frame_bound (width, height, block_bits));
+}
+
+
+int jpeg_compress_bounded (unsigned char* data, unsigned char* destination, size_t capacity)
+{
+    uint8_t* ptr          = data;
+    int      p            = JPEG_HEADER_SIZE << 3; // bit pointer
+    int      w            = width << 1;
+    int      block_stride = (JPEG_BLOCK_SIZE - 1) * w;
+    int16_t  prev_dc      = 0;
+    int16_t  prev_dc_tmp  = 0;
+    size_t   room         = capacity > 2 ? (capacity - 2) << 3 : 0;
+    size_t   row_bits     = (size_t) (width >> 4) * block_bits; // longest row of blocks of any channel
+    int y, x;
+
+    memset (compressed_block, 0, BLOCK_TSIZE * sizeof (int16_t));
+
+    // compress Y
+    for (y = 0; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
+    {
+        ROW_FITS ();
+        for (x = 0; x < w / 2; x += Y_STRIDE, ptr += Y_STRIDE)
+        {
+            COMPRESS (compress_luminance, ptr, compressed_block)
+        }
+        ptr += w - w / 2 - ((w / 2) % Y_STRIDE);
+    }
+    // reset and write to header size in bits of encoded y blocks
+    memcpy (destination, &p, sizeof (int));
+    ptr = data + w / 2 - ((w / 2) % Y_STRIDE);
+    prev_dc = 0;
+
+    for (y = 0 ; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
+    {
+        ROW_FITS ();
+        for (x = w / 2 - ((w / 2) % Y_STRIDE); x < w; x += Y_STRIDE, ptr += Y_STRIDE)
+        {
+            COMPRESS (compress_luminance, ptr, compressed_block)
+        }
+        ptr += w / 2 - ((w / 2) % Y_STRIDE);
+    }
+    // reset and write to header size in bits of encoded y blocks
+    memcpy (destination + sizeof (int), &p, sizeof (int));
+    ptr = data;
+    prev_dc = 0;
+
+    // compress U
+    for (y = 0; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
+    {
+        ROW_FITS ();
+        for (x = 0; x < w; x += UV_STRIDE, ptr += UV_STRIDE)
+        {
+            COMPRESS (compress_blue, ptr, compressed_block)
+        }
+    }
+    // reset and write to header size in bits of encoded u blocks
+    memcpy (destination + 2 * sizeof (int), &p, sizeof (int));
+    ptr = data;
+    prev_dc = 0;
+
+    // compress V
+    for (y = 0; y < height; y += JPEG_BLOCK_SIZE, ptr += block_stride)
+    {
+        ROW_FITS ();
+        for (x = 0; x < w; x += UV_STRIDE, ptr += UV_STRIDE)
+        {
+            COMPRESS (compress_red, ptr, compressed_block)
+        }
+    }
+    // write to header size in bits of encoded v blocks
+    memcpy (destination + 3 * sizeof (int), &p, sizeof (int));
+    return (p >> 3) + 1;
+}
+
+
+/**
+ *  Decode the blocks of a channel on a row of blocks, at bytes first up to
+ *  last of the row stride bytes apart, from bit p with the DC prediction
+ *  prev_dc. func stores each one to strip, 8 rows of pitch bytes.
+ *  Returns non-zero on a corrupt stream.
+ */
+static int decompress_row (uint8_t* data, int* p, int end, int16_t* prev_dc, int16_t* block,
+                           void (*func) (int16_t*, uint8_t*, int), int first, int last, int stride,
+                           uint8_t* strip, int pitch)
+{
+    int n;
+
+    for (int x = first; x < last; x += stride)
+    {
+        // no block starts past the end of the stream, the padding covers what one reads
+        if (*p > end || (n = decode (data, p, block)) < 0)
+            return 1;
+        block[0] += *prev_dc;
+        *prev_dc = block[0];
+        func (block, strip + x, pitch);
+        clear_block (block, n);
+    }
+    return 0;
+}
+
+/**
+ *  Decompress data a strip of 8 rows at a time on the calling thread, every
+ *  channel from where it starts in the header. The strips are stored to frame,
+ *  pitch bytes a row, or without a callback to buffer and passed on to callback.
+ *  Returns non-zero on error.
+ */
+static int decompress_strips (uint8_t* data, size_t size, uint8_t* frame, int pitch,
+                              jpeg_strip_callback callback, void* user)
+{
+    int      w      = width << 1;
+    int      half   = w / 2 - ((w / 2) % Y_STRIDE); // first block of the right half of Y
+    int16_t  dc[4]  = { 0 };
+    int16_t* block  = NULL;
+    int      ret    = 0;
+    int      p[4], end;
+
+    if (read_header (data, size, p, &end) != 0)
+        return 1;
+    if (posix_memalign ((void**) &block, 16, BLOCK_TSIZE * sizeof (int16_t)) != 0)
+        return 1;
+    memset (block, 0, BLOCK_TSIZE * sizeof (int16_t));
+
+    for (int y = 0; y < height && ret == 0; y += JPEG_BLOCK_SIZE)
+    {
+        uint8_t* strip       = callback == NULL ? frame + y * pitch : buffer;
+        int      strip_pitch = callback == NULL ? pitch : w;
+
+        ret = decompress_row (data, &p[0], end, &dc[0], block, decompress_luminance, 0, w / 2, Y_STRIDE, strip, strip_pitch) ||
+              decompress_row (data, &p[1], end, &dc[1], block, decompress_luminance, half, w, Y_STRIDE, strip, strip_pitch) ||
+              decompress_row (data, &p[2], end, &dc[2], block, decompress_blue, 0, w, UV_STRIDE, strip, strip_pitch) ||
+              decompress_row (data, &p[3], end, &dc[3], block, decompress_red, 0, w, UV_STRIDE, strip, strip_pitch);
+        if (ret == 0 && callback != NULL)
+            callback (buffer, y, JPEG_BLOCK_SIZE, user);
+    }
+
+    free (block);
+    return ret;
+}
+
+
+int jpeg_decompress_planes (uint8_t* data, size_t size, uint8_t* const planes[3], const int pitches[3])
+{
+    // UYVY is the only format, a single plane
+    return decompress_strips (data, size, planes[0], pitches[0], NULL, NULL);
+}
+
+
+int jpeg_decompress_strips (uint8_t* data, size_t size, jpeg_strip_callback callback, void* user)
+{
+    // without one decompress_strips would store to a frame, there is none
+    if (callback == NULL)
+        return 1;
+    return decompress_strips (data, size, NULL, 0, callback, user);
+}
+
+
+/**
+ *  Decode only the DC coefficients of the channel starting at bit p, for the
+ *  blocks at bytes first up to last of every row stride bytes apart, and store
+ *  the average of each block to destination, step bytes apart in a row of
+ *  pitch bytes.
+ *  Returns non-zero on a corrupt stream.
+ */
+static int decompress_channel_dc (uint8_t* data, int p, int end, int first, int last, int stride,
+                                  uint8_t* destination, int step, int pitch)
+{
+    int16_t  dc = 0;
+    int      value;
+    uint8_t  symbol;
+    uint16_t amplitude;
+
+    for (int y = 0; y < (height >> 3); y ++, destination += pitch)
+    {
+        for (int x = first, i = 0; x < last; x += stride, i += step)
+        {
+            // DC difference, as in decode
+            if (p > end || (symbol = DECODE_HUFFMAN_DC (data, &p)) == HUFFMAN_INVALID)
+                return 1;
+            amplitude = read_value (data, &p, symbol);
+            if ((amplitude & (1 << (symbol - 1))) == 0)
+                amplitude = ~((~amplitude) & ~(0xFFFF << symbol)) + 1;
+            dc += amplitude;
+            if (skip_ac (huffman_ac_skip, data, &p) != 0)
+                return 1;
+            // the average of the block, the DC step of the table in jpeg.asm is 8
+            value = dc + 128;
+            destination[i] = value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+    }
+    return 0;
+}
+
+
+int jpeg_decode_dc_only (uint8_t* data, size_t size, uint8_t* destination)
+{
+    int w     = width << 1;
+    int half  = w / 2 - ((w / 2) % Y_STRIDE);
+    int pitch = width >> 2; // a UYVY row of width / 8 pixels
+    int p[4], end;
+
+    if (read_header (data, size, p, &end) != 0)
+        return 1;
+    // a Y block is a pixel, a U or V block the chroma of two
+    return decompress_channel_dc (data, p[0], end, 0, w / 2, Y_STRIDE, destination + 1, 2, pitch) ||
+           decompress_channel_dc (data, p[1], end, half, w, Y_STRIDE, destination + 1 + half / Y_STRIDE * 2, 2, pitch) ||
+           decompress_channel_dc (data, p[2], end, 0, w, UV_STRIDE, destination, 4, pitch) ||
+           decompress_channel_dc (data, p[3], end, 0, w, UV_STRIDE, destination + 2, 4, pitch);
+}
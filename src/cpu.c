@@ -0,0 +1,56 @@
+#include "cpu.h"
+#include <stdint.h>
+
+
+/**
+ *  Execute cpuid for leaf eax, sub-leaf ecx and store eax, ebx, ecx, edx to abcd.
+ */
+static void run_cpuid (uint32_t eax, uint32_t ecx, uint32_t abcd[4])
+{
+    uint32_t ebx = 0, edx;
+    __asm__ ("cpuid" : "+b" (ebx), "+a" (eax), "+c" (ecx), "=d" (edx));
+    abcd[0] = eax; abcd[1] = ebx; abcd[2] = ecx; abcd[3] = edx;
+}
+
+/**
+ *  Read the extended control register telling which register states the OS saves.
+ */
+static uint32_t read_xcr0 ()
+{
+    uint32_t xcr0;
+    __asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "%edx");
+    return xcr0;
+}
+
+
+int cpu_features ()
+{
+    uint32_t abcd[4];
+    uint32_t xcr0;
+    int features = 0;
+
+    run_cpuid (0, 0, abcd);
+    uint32_t max_leaf = abcd[0];
+
+    // CPUID.(EAX=01H):ECX.SSE4_1[bit 19], FMA[bit 12], OSXSAVE[bit 27]
+    run_cpuid (1, 0, abcd);
+    if (abcd[2] & (1 << 19))
+        features |= CPU_SSE41;
+    if ((abcd[2] & (1 << 27)) == 0 || max_leaf < 7)
+        return features;
+    int fma = (abcd[2] & (1 << 12)) != 0;
+
+    // xmm and ymm state, then opmask and upper zmm state
+    xcr0 = read_xcr0 ();
+    if ((xcr0 & 0x06) != 0x06)
+        return features;
+
+    // CPUID.(EAX=07H, ECX=0H):EBX.AVX2[bit 5], AVX512F[bit 16], AVX512BW[bit 30]
+    run_cpuid (7, 0, abcd);
+    if ((abcd[1] & (1 << 5)) && fma)
+        features |= CPU_AVX2;
+    if ((abcd[1] & (1 << 16)) && (abcd[1] & (1 << 30)) && (xcr0 & 0xE6) == 0xE6)
+        features |= CPU_AVX512;
+
+    return features;
+}
@@ -2,6 +2,7 @@
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 /* size is computed by doing the binary logarithm of the value.
@@ -15,6 +16,11 @@
                 else\
                     size = log2 (x) + 1;
 
+#define MAX_COEFFICIENT 1024 // magnitude bound of a transformed, level shifted block of 8-bit samples
+#define MAX_DC_SIZE       11
+#define MAX_AC_ENERGY   (64 * 127.5 * 127.5) // of the AC coefficients of a block, the samples about their mean
+#define TRANSFORM_ERROR   2.0 // of a coefficient of the forward transforms, rounding included
+
 // http://www.w3.org/Graphics/JPEG/itu-t81.pdf page 150
 // usage: CODE(size, code) = HUFFMAN[RUNLEN][SIZE]
 const uint16_t huffman_ac[MAX_RUN_LEN + 1][MAX_SIZE + 1][2] =
@@ -44,6 +50,26 @@ const uint16_t huffman_dc[12][2] =
 };
 
 
+/**
+ *  Give every inner node without a child a HUFFMAN_INVALID leaf, the table
+ *  codes leave the pattern of all ones unused.
+ */
+static void complete_huffman_tree (struct huffman_tree_node* node)
+{
+    for (int b = 0; b < 2; b ++)
+    {
+        if (node->children[b] == NULL)
+        {
+            node->children[b] = malloc (sizeof (struct huffman_tree_node));
+            node->children[b]->leaf   = 1;
+            node->children[b]->symbol = HUFFMAN_INVALID;
+        }
+        else if (!node->children[b]->leaf)
+            complete_huffman_tree (node->children[b]);
+    }
+}
+
+
 void create_huffman_ac_tree (struct huffman_tree_node* root)
 {
     uint16_t size, code;
@@ -117,6 +143,7 @@ void create_huffman_ac_tree (struct huffman_tree_node* root)
             }
         }
     }
+    complete_huffman_tree (root);
 }
 
 
@@ -186,6 +213,7 @@ void create_huffman_dc_tree (struct huffman_tree_node* root)
             node->symbol = i;
         }
     }
+    complete_huffman_tree (root);
 }
 
 /**
@@ -209,6 +237,26 @@ uint8_t decode_huffman_value (struct huffman_tree_node* tree, uint8_t* buffer, i
 }
 
 
+void create_huffman_ac_skip_table (uint8_t table[1 << HUFFMAN_SKIP_BITS])
+{
+    uint16_t size, code;
+    memset (table, HUFFMAN_SKIP_INVALID, 1 << HUFFMAN_SKIP_BITS);
+    for (int i = 0; i <= MAX_RUN_LEN; i ++)
+    {
+        for (int j = 0; j <= MAX_SIZE; j ++)
+        {
+            size = huffman_ac[i][j][0];
+            code = huffman_ac[i][j][1];
+            if (!size)
+                continue;
+            // every pattern starting with the code
+            for (int x = 0; x < 1 << (HUFFMAN_SKIP_BITS - size); x ++)
+                table[(code << (HUFFMAN_SKIP_BITS - size)) | x] = (i == 0 && j == 0) ? HUFFMAN_SKIP_EOB | size : size + j;
+        }
+    }
+}
+
+
 void encode_huffman_dc_value (uint16_t amplitude, uint8_t* destination, int* p)
 {
     uint8_t size;
@@ -232,6 +280,110 @@ void encode_huffman_ac_value (uint16_t amplitude, uint8_t run_length, uint8_t* d
 }
 
 
+uint8_t huffman_ac_code_length (uint8_t run_length, uint8_t size)
+{
+    return huffman_ac[run_length][size][0] + size;
+}
+
+
+/**
+ *  Bits of the largest quantized magnitude bound / step, at most max.
+ */
+static int amplitude_size (int bound, int step, int max)
+{
+    int size, value = (bound + (step >> 1)) / step;
+    for (size = 0; value != 0; value >>= 1)
+        size ++;
+    return size < max ? size : max;
+}
+
+/**
+ *  Least energy of a coefficient quantized with step to an amplitude of size
+ *  bits, rounded to nearest from a transform off by up to TRANSFORM_ERROR.
+ */
+static double amplitude_energy (int size, int step)
+{
+    double magnitude = ((1 << (size - 1)) - 0.5) * step - TRANSFORM_ERROR;
+    return magnitude > 0 ? magnitude * magnitude : 0;
+}
+
+/**
+ *  Most of bits - lambda * energy over the AC coefficients of a block, the
+ *  amplitudes of the sizes of zig zag index i taking energy[i][size].
+ */
+static double block_bound_relaxed (int dc_bits, const double energy[64][MAX_SIZE + 1], double lambda)
+{
+    double most[64];                // most up to and including a nonzero coefficient at zig zag index i
+    double code[MAX_RUN_LEN + 1];   // most of a code for index i after run zeroes
+    double value, longest;
+    int    size, run, bits;
+
+    most[0] = longest = dc_bits;
+    // the longest chain of run length codes, a run of more than MAX_RUN_LEN zeroes
+    // takes a code skipping MAX_RUN_LEN of them first
+    for (int i = 1; i < 64; i ++)
+    {
+        for (run = 0; run <= MAX_RUN_LEN; run ++)
+        {
+            code[run] = -HUGE_VAL;
+            for (size = 1; size <= MAX_SIZE && energy[i][size] <= MAX_AC_ENERGY; size ++)
+                if ((value = huffman_ac[run][size][0] + size - lambda * energy[i][size]) > code[run])
+                    code[run] = value;
+        }
+        most[i] = -HUGE_VAL;
+        for (int j = 0; j < i; j ++)
+        {
+            bits = 0;
+            for (run = i - j - 1; run > MAX_RUN_LEN; run -= MAX_RUN_LEN)
+                bits += huffman_ac[MAX_RUN_LEN][0][0];
+            if ((value = most[j] + bits + code[run]) > most[i])
+                most[i] = value;
+        }
+        if (most[i] > longest)
+            longest = most[i];
+    }
+    // end of block
+    return longest + huffman_ac[0][0][0];
+}
+
+int huffman_block_bound (const uint16_t* steps)
+{
+    double energy[64][MAX_SIZE + 1];
+    double low, high, a, b, fa, fb, bound;
+    int    size, dc_bits;
+
+    // the DC difference of two blocks
+    size    = amplitude_size (MAX_COEFFICIENT << 1, steps != NULL ? steps[0] : 1, MAX_DC_SIZE);
+    dc_bits = huffman_dc[size][0] + size;
+    for (int i = 1; i < 64; i ++)
+        for (size = 1; size <= MAX_SIZE; size ++)
+            energy[i][size] = amplitude_energy (size, steps != NULL ? steps[i] : 1);
+
+    // The transform keeps the energy of the samples, so the AC coefficients
+    // together have at most MAX_AC_ENERGY and can not all be at their largest.
+    // For any lambda >= 0 the relaxed most + lambda * MAX_AC_ENERGY bounds the
+    // bits of every block within it, the smallest one found is taken. It is
+    // convex in lambda, which is searched for it between 0 and the point
+    // where it exceeds the bound without the energy limit.
+    bound = block_bound_relaxed (dc_bits, energy, 0);
+    low   = 0;
+    high  = bound / MAX_AC_ENERGY;
+    for (int k = 0; k < 24; k ++)
+    {
+        a  = low + (high - low) / 3;
+        b  = high - (high - low) / 3;
+        fa = block_bound_relaxed (dc_bits, energy, a) + a * MAX_AC_ENERGY;
+        fb = block_bound_relaxed (dc_bits, energy, b) + b * MAX_AC_ENERGY;
+        bound = fmin (bound, fmin (fa, fb));
+        if (fa < fb)
+            high = b;
+        else
+            low = a;
+    }
+    return (int) ceil (bound);
+}
+
+
 void destroy_huffman_tree (struct huffman_tree_node* root)
 {
     if (root->children[1] && root->children[1]->leaf)
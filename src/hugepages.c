@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include "hugepages.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+#define THP_ENABLED "/sys/kernel/mm/transparent_hugepage/enabled"
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26) // log2 of the page size at MAP_HUGE_SHIFT
+#endif
+
+
+static int mode = HUGEPAGES_NONE;
+
+
+static inline size_t round_up (size_t size)
+{
+    return (size + HUGEPAGE_SIZE - 1) & ~((size_t) HUGEPAGE_SIZE - 1);
+}
+
+/**
+ *  Returns non-zero if the kernel has transparent huge pages and does not
+ *  have them set to never.
+ */
+static int transparent_hugepages ()
+{
+    char setting[64];
+    FILE* fp = fopen (THP_ENABLED, "r");
+    if (fp == NULL)
+        return 0;
+    int ok = fgets (setting, sizeof (setting), fp) != NULL && strstr (setting, "[never]") == NULL;
+    fclose (fp);
+    return ok;
+}
+
+
+void* hugepages_alloc (size_t size)
+{
+    uint8_t* memory;
+    size_t   head;
+    int      m = HUGEPAGES_SMALL;
+
+    size = round_up (size);
+
+    // reserved pages, the mapping fails if the pool is short of them
+    memory = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (memory != MAP_FAILED)
+        m = HUGEPAGES_HUGETLB;
+    else
+    {
+        // one huge page more to align to one, then unmap the ends
+        memory = mmap (NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return NULL;
+        head = (HUGEPAGE_SIZE - ((uintptr_t) memory & (HUGEPAGE_SIZE - 1))) & (HUGEPAGE_SIZE - 1);
+        if (head > 0)
+            munmap (memory, head);
+        munmap (memory + head + size, HUGEPAGE_SIZE - head);
+        memory += head;
+
+        if (transparent_hugepages () && madvise (memory, size, MADV_HUGEPAGE) == 0)
+            m = HUGEPAGES_MADVISE;
+    }
+
+    if (mode == HUGEPAGES_NONE || m < mode)
+        mode = m;
+    return memory;
+}
+
+
+void hugepages_free (void* memory, size_t size)
+{
+    if (memory != NULL)
+        munmap (memory, round_up (size));
+}
+
+
+int hugepages_mode ()
+{
+    return mode;
+}
+
+
+const char* hugepages_mode_name (int m)
+{
+    switch (m)
+    {
+        case HUGEPAGES_SMALL:
+            return "regular pages";
+        case HUGEPAGES_MADVISE:
+            return "transparent huge pages (madvise)";
+        case HUGEPAGES_HUGETLB:
+            return "reserved huge pages (hugetlb)";
+        default:
+            return "none";
+    }
+}
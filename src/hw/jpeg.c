@@ -2,10 +2,14 @@
 #include "ui.h"
 #include "gpu.h"
 #include "huffman.h"
+#include "decode.h"
 #include "utils.h"
+#include "hugepages.h"
+#include "quantization.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 #include <CL/cl.h>
 
 
@@ -40,7 +44,11 @@ static uint8_t zigzag[JPEG_BLOCK_SIZE * JPEG_BLOCK_SIZE][2] =
 
 static int       width,
                  height;
-static DATATYPE* blocks;
+static DATATYPE* blocks;     // 64 coefficients in rows per block, the Y blocks in raster order then U then V
+static uint8_t*  block_last; // zig zag index of the last nonzero coefficient of each block in decode order
+#ifdef JPEG_HW__USE_OPENCL
+static int       idct_method = JPEG_IDCT_FLOAT;
+#endif
 static int16_t   prev_dc;
 
 
@@ -61,7 +69,7 @@ static inline void encode (DATATYPE* block, uint8_t* destination, int* p)
     // encode AC coefficients
     for (int i = 1; i < BLOCK_TSIZE; i ++)
     {
-        amplitude = block[(zigzag[i][1] * width) + zigzag[i][0]];
+        amplitude = block[(zigzag[i][1] << 3) + zigzag[i][0]];
         if (amplitude == 0)
         {
             run_length ++;
@@ -82,12 +90,19 @@ static inline void encode (DATATYPE* block, uint8_t* destination, int* p)
 }
 
 /**
- *  Decode entropy data.
+ *  Decode entropy data. The coefficients the previous block decoded at this
+ *  position wrote, up to zig zag index *last, are zeroed first and *last is
+ *  set for the next frame, also when the block turns out corrupt.
+ *  Returns non-zero on a corrupt block.
  */
-static inline void decode (uint8_t* data, int* p, DATATYPE* block)
+static inline int decode (uint8_t* data, int* p, DATATYPE* block, uint8_t* last)
 {
+    clear_block (block, *last);
+
     // decode DC coefficient
     uint8_t  symbol    = DECODE_HUFFMAN_DC (data, p);
+    if (symbol == HUFFMAN_INVALID)
+        return 1;
     uint16_t amplitude = read_value (data, p, symbol);
     // check if it was a negative value
     if ((amplitude & (1 << (symbol - 1))) == 0)
@@ -99,112 +114,82 @@ static inline void decode (uint8_t* data, int* p, DATATYPE* block)
     // fill rest of block
     int i = 1;
     uint8_t run, size;
+    *last = 0;
     while ((symbol = DECODE_HUFFMAN_AC (data, p)) != EOB)
     {
         run  = symbol >> 4;
         size = symbol & 0xF;
         i   += run; // skip zeroes
+        if (corrupt_code (i, symbol))
+            return 1;
         if (size > 0)
         {
             amplitude = read_value (data, p, size);
             if ((amplitude & (1 << (size - 1))) == 0) // handle negative values
                 amplitude = ~((~amplitude) & ~(0xFFFF << size)) + 1;
-            block[(zigzag[i][1] * width) + zigzag[i][0]] = (int16_t) amplitude;
-            i ++;
+            block[(zigzag[i][1] << 3) + zigzag[i][0]] = (int16_t) amplitude;
+            *last = i ++;
         }
     }
+    return 0;
 }
 
 
-static int encode_blocks (uint8_t* destination)
+/**
+ *  Encode the blocks to destination of capacity bytes, checking the room
+ *  for the longest coding of a row of blocks before every row.
+ *  Returns the size, or zero if it does not fit.
+ */
+static int encode_blocks (uint8_t* destination, size_t capacity)
 {
-    int ptr = 0;
-    int w = width >> 1;
-    int16_t* blockp = blocks;
-    prev_dc = 0;
-    // Y
-    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
-    {
-        for (int x = 0; x < width; x += JPEG_BLOCK_SIZE)
-        {
-            encode (blockp, destination, &ptr);
-            blockp += JPEG_BLOCK_SIZE;
-        }
-        blockp += (JPEG_BLOCK_SIZE - 1) * width;
-    }
-    prev_dc = 0;
-    blockp = blocks + height * width;
-    // U
-    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
-    {
-        for (int x = 0; x < w; x += JPEG_BLOCK_SIZE)
-        {
-            encode (blockp, destination, &ptr);
-            blockp += JPEG_BLOCK_SIZE;
-        }
-        blockp += (JPEG_BLOCK_SIZE) * width - w;
-    }
-    prev_dc = 0;
-    blockp = blocks + height * width + w;
-    // V
-    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
+    int    ptr      = 0;
+    size_t room     = capacity > 2 ? (capacity - 2) << 3 : 0;
+    int    bound    = huffman_block_bound (NULL);
+    DATATYPE* blockp = blocks;
+
+    // Y, U, V
+    for (int c = 0; c < 3; c ++)
     {
-        for (int x = 0; x < w; x += JPEG_BLOCK_SIZE)
+        int n = c == 0 ? width >> 3 : width >> 4; // blocks per row
+        prev_dc = 0;
+        for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
         {
-            encode (blockp, destination, &ptr);
-            blockp += JPEG_BLOCK_SIZE;
+            if ((size_t) ptr + n * bound > room)
+                return 0;
+            for (int k = 0; k < n; k ++, blockp += BLOCK_TSIZE)
+                encode (blockp, destination, &ptr);
         }
-        blockp += (JPEG_BLOCK_SIZE) * width - w;
     }
 
     return ptr / 8 + 1;
 }
 
 
-static void decode_blocks (uint8_t* data)
+/**
+ *  Decode a frame of size bytes into blocks, clearing only the coefficients
+ *  the previous frame wrote instead of the whole buffer. The end is checked
+ *  before every block, the padding after it covers the reads of one.
+ *  Returns non-zero on a corrupt or truncated frame.
+ */
+static int decode_blocks (uint8_t* data, size_t size)
 {
     int ptr = 0;
-    memset (blocks, 0, width * height * 2 * sizeof (DATATYPE));
-    DATATYPE* block_ptr = blocks;
-    int w = width >> 1;
-    prev_dc = 0;
-
-    // decode blocks
-    // y blocks
-    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
-    {
-        for (int x = 0; x < width; x += JPEG_BLOCK_SIZE)
-        {
-            decode (data, &ptr, block_ptr);
-            block_ptr += JPEG_BLOCK_SIZE;
-        }
-        block_ptr += 7 * width;
-    }
+    int end = size << 3;
+    int n   = (width >> 3) * (height >> 3); // Y blocks, U and V have half as many
+    DATATYPE* blockp = blocks;
+    uint8_t*  last   = block_last;
 
-    // u blocks
-    prev_dc = 0;
-    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
-    {
-        for (int x = 0; x < w; x += JPEG_BLOCK_SIZE)
-        {
-            decode (data, &ptr, block_ptr);
-            block_ptr += JPEG_BLOCK_SIZE;
-        }
-        block_ptr += JPEG_BLOCK_SIZE * width - w;
-    }
-
-    // v blocks
-    prev_dc = 0;
-    block_ptr = blocks + height * width + w;
-    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
+    if (size > (INT_MAX >> 3) - JPEG_DECODE_PADDING)
+        return 1;
+    // Y, U, V
+    for (int c = 0; c < 3; c ++)
     {
-        for (int x = 0; x < w; x += JPEG_BLOCK_SIZE)
-        {
-            decode (data, &ptr, block_ptr);
-            block_ptr += JPEG_BLOCK_SIZE;
-        }
-        block_ptr += JPEG_BLOCK_SIZE * width - w;
+        prev_dc = 0;
+        for (int k = 0; k < (c == 0 ? n : n >> 1); k ++, blockp += BLOCK_TSIZE)
+            if (ptr > end || decode (data, &ptr, blockp, last ++) != 0)
+                return 1;
     }
+    return 0;
 }
 
 
@@ -233,10 +218,16 @@ static void deinit_huffman ()
 int jpeg_init (int w, int h, GLuint texbuf)
 {
     width = w; height = h;
-    blocks = malloc (width * height * 2 * sizeof (DATATYPE));
+    // zeroed, on huge pages when the system has them and every block on its own pair of cache lines
+    if ((blocks = hugepages_alloc (width * height * 2 * sizeof (DATATYPE))) == NULL ||
+        (block_last = calloc (width * height * 2 / BLOCK_TSIZE, sizeof (uint8_t))) == NULL)
+    {
+        fprintf (stderr, "error allocating init memory\n");
+        return 1;
+    }
     init_huffman ();
 #ifdef JPEG_HW__USE_OPENCL
-    if (init_opencl (width, height, texbuf) != 0)
+    if (init_opencl (width, height, texbuf, idct_method == JPEG_IDCT_INT) != 0)
     {
         fprintf (stderr, "error initializing OpenCL\n");
         return 1;
@@ -252,52 +243,97 @@ int jpeg_init (int w, int h, GLuint texbuf)
 }
 
 
+int jpeg_set_option (int option, int value)
+{
+    switch (option)
+    {
+#ifdef JPEG_HW__USE_OPENCL
+        case JPEG_OPTION_IDCT:
+            if (value != JPEG_IDCT_FLOAT && value != JPEG_IDCT_INT)
+                return 1;
+            idct_method = value;
+            return 0;
+#endif
+        // no worker threads on the host side
+        default:
+            return 1;
+    }
+}
+
+
 void jpeg_deinit ()
 {
-    free (blocks);
+    hugepages_free (blocks, width * height * 2 * sizeof (DATATYPE));
+    free (block_last);
     deinit_huffman ();
     deinit_opencl ();
     deinit_compute_shader ();
 }
 
 
+size_t jpeg_compress_bound (int w, int h, int quality)
+{
+    uint16_t table[BLOCK_TSIZE], steps[BLOCK_TSIZE];
+    size_t   bits;
+
+    // the quantization of the kernels is fixed to the default table
+    if (quality != 0)
+        return 0;
+    quantization_table (0, QUANTIZATION_LUMA, table);
+    for (int i = 0; i < BLOCK_TSIZE; i ++)
+        steps[i] = table[decode_zigzag[i]];
+    // luma, and U and V together
+    bits = 2 * (size_t) (w >> 3) * (h >> 3) * huffman_block_bound (steps);
+    return ((bits + 7) >> 3) + 2;
+}
+
+
 int jpeg_compress (uint8_t* data, uint8_t* destination)
 {
-    memset (blocks, 0, width * height * 2 * sizeof (DATATYPE));
+    return jpeg_compress_bounded (data, destination, jpeg_compress_bound (width, height, 0));
+}
+
 
+int jpeg_compress_bounded (uint8_t* data, uint8_t* destination, size_t capacity)
+{
     DATATYPE* yblocks   = blocks;
     DATATYPE* ublocks   = blocks + width * height;
-    DATATYPE* vblocks   = blocks + width * height + (width >> 1);
+    DATATYPE* vblocks   = ublocks + (width * height >> 1);
     uint8_t*  datap     = data;
 
-    // unpack blocks
+    // unpack rows into blocks, a strip of 8 rows holds width * 8 Y and width * 4 U and V coefficients
     for (int y = 0; y < height; y ++)
     {
+        DATATYPE* yrow = yblocks + (y >> 3) * (width << 3) + ((y & 7) << 3);
+        DATATYPE* urow = ublocks + (y >> 3) * (width << 2) + ((y & 7) << 3);
+        DATATYPE* vrow = vblocks + (y >> 3) * (width << 2) + ((y & 7) << 3);
         for (int x = 0; x < (width >> 1); x ++)
         {
-            yblocks[(x << 1)]     = datap[1];
-            yblocks[(x << 1) + 1] = datap[3];
-            ublocks[x]            = datap[0];
-            vblocks[x]            = datap[2];
+            int l = ((x >> 2) << 6) + ((x & 3) << 1); // luma column 2x
+            int k = ((x >> 3) << 6) + (x & 7);        // chroma column x
+
+            yrow[l]     = datap[1];
+            yrow[l + 1] = datap[3];
+            urow[k]     = datap[0];
+            vrow[k]     = datap[2];
 
             datap += 4;
         }
-        ublocks += width;
-        vblocks += width;
-        yblocks += width;
     }
 
-    // compress
+    // compress, the quantized blocks come back whole so the next decode clears them entirely
     compress_blocks (blocks);
+    memset (block_last, BLOCK_TSIZE - 1, width * height * 2 / BLOCK_TSIZE);
 
     // encode
-    return encode_blocks (destination);
+    return encode_blocks (destination, capacity);
 }
 
 
 int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destination)
 {
-    decode_blocks (data);
+    if (decode_blocks (data, size) != 0)
+        return 1;
     // send to gpu and decompress
     decompress_blocks (blocks, destination);
     return 0;
@@ -306,7 +342,8 @@ int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destinatio
 
 int jpeg_decompress_to_texture (uint8_t* data, size_t size, GLuint texture)
 {
-    decode_blocks (data);
+    if (decode_blocks (data, size) != 0)
+        return 1;
     decompress_blocks_to_texture (blocks, texture);
     return 0;
 }
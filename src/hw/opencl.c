@@ -11,6 +11,7 @@
 
 #define KERNEL_SRC              "src/kernels/jpeg.cl"
 #define DECOMPRESS_KERNEL       "decompress"
+#define DECOMPRESS_INT_KERNEL   "decompress_int"
 #define COMPRESS_KERNEL         "compress"
 #define WORK_DIMENSIONS         2
 #define BUFFER_SIZE             width * height * 2
@@ -78,11 +79,11 @@ static int create_kernel (const char* name, cl_kernel* kernel)
 }
 
 /**
- *  Create our decompress kernel.
+ *  Create our decompress kernel, with the integer transform if integer_idct is set.
  */
-static int create_decompress_kernel ()
+static int create_decompress_kernel (int integer_idct)
 {
-    if (create_kernel (DECOMPRESS_KERNEL, &decompress_kernel) != 0)
+    if (create_kernel (integer_idct ? DECOMPRESS_INT_KERNEL : DECOMPRESS_KERNEL, &decompress_kernel) != 0)
         return 1;
 
     // set kernel arguments
@@ -112,7 +113,7 @@ static int create_compress_kernel ()
 /**
  *  Initialize OpenCL components.
  */
-int init_opencl (int width_, int height_, GLuint texture)
+int init_opencl (int width_, int height_, GLuint texture, int integer_idct)
 {
     cl_int ret;
     cl_uint count;
@@ -212,7 +213,7 @@ int init_opencl (int width_, int height_, GLuint texture)
     }
 
     // create kernels
-    if (create_decompress_kernel () != 0)
+    if (create_decompress_kernel (integer_idct) != 0)
         return 1;
 
     if (create_compress_kernel () != 0)
@@ -14,6 +14,25 @@
 
 #define     BLOCK_SIZE  8
 
+/* fixed point constants of the integer transform, round (x * 2^CONST_BITS) */
+#define     CONST_BITS  13
+#define     PASS1_BITS  2
+
+#define     FIX_0_298631336  2446
+#define     FIX_0_390180644  3196
+#define     FIX_0_541196100  4433
+#define     FIX_0_765366865  6270
+#define     FIX_0_899976223  7373
+#define     FIX_1_175875602  9633
+#define     FIX_1_501321110 12299
+#define     FIX_1_847759065 15137
+#define     FIX_1_961570560 16069
+#define     FIX_2_053119869 16819
+#define     FIX_2_562915447 20995
+#define     FIX_3_072711026 25172
+
+#define     DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
 
 /* C matrix for making transformations between frequency domain and spatial domain. */
 __constant float c[8][8] =
@@ -42,6 +61,27 @@ __constant short q[8][8] =
     { 36.0, 46.0, 47.0, 45.0, 56.0, 50.0, 51.0, 49.0 }
 };
 
+/**
+ *  First coefficient of the block holding work item x, y of the width x
+ *  2 * height frame of Y above U and V. Blocks are 64 contiguous coefficients
+ *  in rows, the Y blocks in raster order followed by the U and then the V blocks.
+ */
+int block_offset (int x, int y, int width, int height)
+{
+    int n;
+    if (y < height)
+        n = (y >> 3) * (width >> 3) + (x >> 3);
+    else
+    {
+        n = (height >> 3) * (width >> 3) + ((y - height) >> 3) * (width >> 4);
+        if (x < width >> 1)
+            n += x >> 3;
+        else
+            n += (height >> 3) * (width >> 4) + ((x - (width >> 1)) >> 3);
+    }
+    return n << 6;
+}
+
 /**
  *  Decompress JPEG data to destination buffer.
  */
@@ -58,13 +98,13 @@ __kernel void decompress (__global short* data,
     int ly = get_local_id  (1);
 
     // dequantize
-    data[y * width + x] *= q[ly][lx];
+    __global short* block = &data[block_offset (x, y, width, height)];
+    block[(ly << 3) + lx] *= q[ly][lx];
     barrier (CLK_LOCAL_MEM_FENCE);
 
     // mutlitply Ct
-    __global short* block = &data[x + (y & ~7) * width];
     float v = 0.f;
-    for (int i = 0, j = 0; i < BLOCK_SIZE; i ++, j += width)
+    for (int i = 0, j = lx; i < BLOCK_SIZE; i ++, j += BLOCK_SIZE)
         v += c[i][ly] * block[j];
     transformed[ly][lx] = v;
     barrier (CLK_LOCAL_MEM_FENCE);
@@ -89,6 +129,129 @@ __kernel void decompress (__global short* data,
 }
 
 
+/**
+ *  1-D integer inverse transform, same arithmetic as iidct1 in src/std/dct.c
+ *  so results are bit-exact with the std backend.
+ */
+void iidct1 (int src[BLOCK_SIZE], int destination[BLOCK_SIZE], int shift)
+{
+    int tmp0, tmp1, tmp2, tmp3;
+    int tmp10, tmp11, tmp12, tmp13;
+    int z1, z2, z3, z4, z5;
+
+    // even part
+    z2   = src[2];
+    z3   = src[6];
+    z1   = (z2 + z3) * FIX_0_541196100;
+    tmp2 = z1 - z3 * FIX_1_847759065;
+    tmp3 = z1 + z2 * FIX_0_765366865;
+
+    tmp0 = (src[0] + src[4]) * (1 << CONST_BITS);
+    tmp1 = (src[0] - src[4]) * (1 << CONST_BITS);
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    // odd part
+    tmp0 = src[7];
+    tmp1 = src[5];
+    tmp2 = src[3];
+    tmp3 = src[1];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    z4 = tmp1 + tmp3;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp0 *= FIX_0_298631336;
+    tmp1 *= FIX_2_053119869;
+    tmp2 *= FIX_3_072711026;
+    tmp3 *= FIX_1_501321110;
+    z1   *= - FIX_0_899976223;
+    z2   *= - FIX_2_562915447;
+    z3    = z3 * - FIX_1_961570560 + z5;
+    z4    = z4 * - FIX_0_390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    destination[0] = DESCALE (tmp10 + tmp3, shift);
+    destination[7] = DESCALE (tmp10 - tmp3, shift);
+    destination[1] = DESCALE (tmp11 + tmp2, shift);
+    destination[6] = DESCALE (tmp11 - tmp2, shift);
+    destination[2] = DESCALE (tmp12 + tmp1, shift);
+    destination[5] = DESCALE (tmp12 - tmp1, shift);
+    destination[3] = DESCALE (tmp13 + tmp0, shift);
+    destination[4] = DESCALE (tmp13 - tmp0, shift);
+}
+
+/**
+ *  Decompress JPEG data to destination buffer using the integer transform.
+ *  The first row of work items transforms the columns, the first column
+ *  of work items the rows, and all of them store their own pixel.
+ */
+__kernel void decompress_int (__global short* data,
+                              __global uchar* destination,
+                                 const int    width,
+                                 const int    height)
+{
+    __local int   transformed[BLOCK_SIZE][BLOCK_SIZE];
+    __local uchar pixels[BLOCK_SIZE][BLOCK_SIZE];
+    int in[BLOCK_SIZE], out[BLOCK_SIZE];
+
+    int x  = get_global_id (0);
+    int y  = get_global_id (1);
+    int lx = get_local_id  (0);
+    int ly = get_local_id  (1);
+
+    // dequantize
+    __global short* block = &data[block_offset (x, y, width, height)];
+    block[(ly << 3) + lx] *= q[ly][lx];
+    barrier (CLK_GLOBAL_MEM_FENCE);
+
+    // columns, keeping PASS1_BITS of extra precision
+    if (ly == 0)
+    {
+        for (int i = 0, j = lx; i < BLOCK_SIZE; i ++, j += BLOCK_SIZE)
+            in[i] = block[j];
+        iidct1 (in, out, CONST_BITS - PASS1_BITS);
+        for (int i = 0; i < BLOCK_SIZE; i ++)
+            transformed[i][lx] = out[i];
+    }
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    // rows
+    if (lx == 0)
+    {
+        for (int i = 0; i < BLOCK_SIZE; i ++)
+            in[i] = transformed[ly][i];
+        iidct1 (in, out, CONST_BITS + PASS1_BITS + 3);
+        for (int i = 0; i < BLOCK_SIZE; i ++)
+            pixels[ly][i] = clamp (out[i], 0, 255);
+    }
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    uchar value = pixels[ly][lx];
+
+    // unpack and interleave values to destination buffer
+    // Y
+    if (y < height)
+        destination[y * width * 2 + x * 2 + 1] = value;
+    else
+        // U
+        if (x < width >> 1)
+            destination[(y - height) * width * 2 + x * 4] = value;
+        // V
+        else
+            destination[(y - height) * width * 2 + (x - (width >> 1)) * 4 + 2] = value;
+}
+
+
 __kernel void compress (__global short* data,
                            const int    width,
                            const int    height)
@@ -100,12 +263,12 @@ __kernel void compress (__global short* data,
     int lx = get_local_id  (0);
     int ly = get_local_id  (1);
 
-    __global short* col = &data[x + (y & ~7) * width];
+    __global short* block = &data[block_offset (x, y, width, height)];
 
     // multiply C
     float v = 0.f;
-    for (int i = 0, j = 0; i < BLOCK_SIZE; i ++, j += width)
-        v += c[ly][i] * col[j];
+    for (int i = 0, j = lx; i < BLOCK_SIZE; i ++, j += BLOCK_SIZE)
+        v += c[ly][i] * block[j];
 
     transformed[ly][lx] = v;
     barrier (CLK_LOCAL_MEM_FENCE);
@@ -120,5 +283,5 @@ __kernel void compress (__global short* data,
         v = (v - 1024.0) / 8.0;
     else
         v /= q[ly][lx];
-    data[y * width + x] = convert_short_sat_rte (v);
+    block[(ly << 3) + lx] = convert_short_sat_rte (v);
 }
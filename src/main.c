@@ -33,13 +33,16 @@ int compress_decompress (const char* cmd, int width, int height, const char* fin
         unsigned long int longest_duration  = 0;
         unsigned long int duration          = 0;
 
-        dest = malloc (width * height * 2);
+        size_t capacity = jpeg_compress_bound (width, height, 0);
+        dest = calloc (capacity, 1);
         int ret = 0;
 
         for (int i = 0; i < ITERATIONS; i ++)
         {
+            if (ret > 0)
+                memset (dest, 0, ret);
             clock_gettime (CLOCK_MONOTONIC, &uno);
-            ret = jpeg_compress (img, dest);
+            ret = jpeg_compress_bounded (img, dest, capacity);
             clock_gettime (CLOCK_MONOTONIC, &dos);
 
             duration = (dos.tv_nsec - uno.tv_nsec) + (dos.tv_sec - uno.tv_sec)  * BILLION;
@@ -0,0 +1,211 @@
+#include "mjpg.h"
+#include "jpeg/jpeg.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 // reversed Castagnoli
+
+#if JPEG_DECODE_PADDING > MJPG_ALIGN
+#error "the page after a payload no longer covers the padding of the decoder"
+#endif
+
+
+static const uint8_t zeroes[MJPG_ALIGN];
+static uint32_t      crc_table[256];
+
+
+static inline uint64_t align (uint64_t offset)
+{
+    return (offset + MJPG_ALIGN - 1) & ~((uint64_t) MJPG_ALIGN - 1);
+}
+
+static void init_crc_table ()
+{
+    uint32_t crc;
+    for (uint32_t i = 0; i < 256; i ++)
+    {
+        crc = i;
+        for (int k = 0; k < 8; k ++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        crc_table[i] = crc;
+    }
+}
+
+/**
+ *  CRC-32C of size bytes of data, a byte at a time.
+ */
+static uint32_t checksum (const uint8_t* data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i ++)
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ *  Write zeroes from offset up to the next multiple of MJPG_ALIGN.
+ *  Returns non-zero on error.
+ */
+static int pad (FILE* fp, uint64_t offset)
+{
+    size_t n = align (offset) - offset;
+    return n > 0 && fwrite (zeroes, 1, n, fp) != n;
+}
+
+
+int mjpg_create (mjpg_writer* writer, const char* path, int width, int height, uint32_t flags)
+{
+    memset (writer, 0, sizeof (mjpg_writer));
+    init_crc_table ();
+    writer->flags  = flags;
+    writer->width  = width;
+    writer->height = height;
+
+    // the header page, written again by mjpg_finish
+    if ((writer->fp = fopen (path, "wb")) == NULL)
+        return 1;
+    if (fwrite (zeroes, 1, MJPG_ALIGN, writer->fp) != MJPG_ALIGN)
+    {
+        fclose (writer->fp);
+        return 1;
+    }
+    return 0;
+}
+
+
+int mjpg_write (mjpg_writer* writer, const uint8_t* data, size_t size, int64_t timestamp, int quality)
+{
+    struct mjpg_frame* frame;
+    off_t              offset = ftello (writer->fp);
+
+    if (offset < 0 || size > UINT32_MAX)
+        return 1;
+    if (writer->frames == writer->allocated)
+    {
+        uint64_t n = writer->allocated > 0 ? writer->allocated << 1 : 1024;
+        if ((frame = realloc (writer->table, n * sizeof (struct mjpg_frame))) == NULL)
+            return 1;
+        writer->table     = frame;
+        writer->allocated = n;
+    }
+
+    // every payload starts on a page, the previous one was padded up to it
+    if (fwrite (data, 1, size, writer->fp) != size || pad (writer->fp, offset + size) != 0)
+        return 1;
+
+    frame = &writer->table[writer->frames ++];
+    memset (frame, 0, sizeof (struct mjpg_frame));
+    frame->offset    = offset;
+    frame->size      = size;
+    frame->checksum  = writer->flags & MJPG_CHECKSUMS ? checksum (data, size) : 0;
+    frame->timestamp = timestamp;
+    frame->quality   = quality;
+    return 0;
+}
+
+
+int mjpg_finish (mjpg_writer* writer)
+{
+    struct mjpg_header header;
+    size_t             bytes  = writer->frames * sizeof (struct mjpg_frame);
+    off_t              offset = ftello (writer->fp);
+    int                ret    = offset < 0;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, MJPG_MAGIC, sizeof (header.magic));
+    header.version = MJPG_VERSION;
+    header.flags   = writer->flags;
+    header.width   = writer->width;
+    header.height  = writer->height;
+    header.frames  = writer->frames;
+    header.table   = offset;
+
+    // the table padded to whole pages, a zero page if empty, so at least a
+    // page follows the last payload
+    if (ret == 0)
+        ret = (bytes > 0 ? fwrite (writer->table, 1, bytes, writer->fp) != bytes :
+                           fwrite (zeroes, 1, MJPG_ALIGN, writer->fp) != MJPG_ALIGN) ||
+              pad (writer->fp, offset + bytes) != 0 ||
+              fseeko (writer->fp, 0, SEEK_SET) != 0 ||
+              fwrite (&header, 1, sizeof (header), writer->fp) != sizeof (header);
+    ret |= fclose (writer->fp) != 0;
+    free (writer->table);
+    memset (writer, 0, sizeof (mjpg_writer));
+    return ret;
+}
+
+
+int mjpg_open (mjpg_video* video, const char* path)
+{
+    const struct mjpg_header* header;
+    const struct mjpg_frame*  frame;
+    struct stat               st;
+    int                       fd = open (path, O_RDONLY);
+
+    memset (video, 0, sizeof (mjpg_video));
+    init_crc_table ();
+    if (fd < 0)
+        return 1;
+    if (fstat (fd, &st) != 0 || st.st_size < MJPG_ALIGN)
+    {
+        close (fd);
+        return 1;
+    }
+    video->length = st.st_size;
+    video->base   = mmap (NULL, video->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (video->base == MAP_FAILED)
+    {
+        video->base = NULL;
+        return 1;
+    }
+    // played front to back, read ahead
+    madvise (video->base, video->length, MADV_SEQUENTIAL);
+
+    // the table in the file with a page after it, every payload before it
+    header = (const struct mjpg_header*) video->base;
+    if (memcmp (header->magic, MJPG_MAGIC, sizeof (header->magic)) != 0 ||
+        header->version != MJPG_VERSION ||
+        header->table < MJPG_ALIGN || header->table % MJPG_ALIGN != 0 || header->table > video->length ||
+        header->frames > (video->length - header->table) / sizeof (struct mjpg_frame) ||
+        video->length - header->table < MJPG_ALIGN)
+    {
+        mjpg_close (video);
+        return 1;
+    }
+    frame = (const struct mjpg_frame*) (video->base + header->table);
+    for (uint64_t i = 0; i < header->frames; i ++, frame ++)
+    {
+        if (frame->offset < MJPG_ALIGN || frame->offset % MJPG_ALIGN != 0 ||
+            frame->offset > header->table || frame->size > header->table - frame->offset)
+        {
+            mjpg_close (video);
+            return 1;
+        }
+    }
+
+    video->header = header;
+    video->table  = (const struct mjpg_frame*) (video->base + header->table);
+    return 0;
+}
+
+
+void mjpg_close (mjpg_video* video)
+{
+    if (video->base != NULL)
+        munmap (video->base, video->length);
+    memset (video, 0, sizeof (mjpg_video));
+}
+
+
+int mjpg_verify (const mjpg_video* video, uint64_t i)
+{
+    if ((video->header->flags & MJPG_CHECKSUMS) == 0)
+        return 0;
+    return checksum (video->base + video->table[i].offset, video->table[i].size) != video->table[i].checksum;
+}
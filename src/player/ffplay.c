@@ -1,4 +1,5 @@
 #include "ui.h"
+#include "hugepages.h"
 #include <stdio.h>
 #include <string.h>
 #include <libavformat/avformat.h>
@@ -265,15 +266,21 @@ static void check_events ()
 }
 
 /**
- *  Transcode the stream.
- *  Takes a function pointer to a store function.
+ *  Play the stream.
+ *  Returns non-zero on error.
  */
-static void play ()
+static int play ()
 {
     stop = 0;
-    planar_image = malloc (decoder_ctx->width * decoder_ctx->height * 2);
+    planar_image = hugepages_alloc (decoder_ctx->width * decoder_ctx->height * 2);
     int iterations = 0;
 
+    if (planar_image == NULL)
+    {
+        fprintf (stderr, "failed to allocate the frame buffer\n");
+        return 1;
+    }
+
     /* for timing decoding */
     struct timespec uno, dos;
     unsigned long int total_duration    = 0;
@@ -339,7 +346,7 @@ loop:
         av_packet_unref (&original);
         check_events ();
     }
-    free (planar_image);
+    hugepages_free (planar_image, decoder_ctx->width * decoder_ctx->height * 2);
 
     printf ("\n");
     printf ("results:\n");
@@ -350,6 +357,7 @@ loop:
     printf ("  shortest time: %6.4f s\n", (double) shortest_duration / BILLION);
     printf ("  fps:           %6.4f  \n", (double) 1.0 / (total_duration / BILLION / iterations));
     printf ("\n");
+    return 0;
 }
 
 
@@ -362,8 +370,8 @@ int main (int argc, char** argv)
         fprintf (stderr, "error opening media file\n");
         return 1;
     };
-    play ();
+    int ret = play ();
     close ();
     deinit_ui ();
-    return 0;
+    return ret;
 }
@@ -1,5 +1,7 @@
 #include "ui.h"
 #include "jpeg/jpeg.h"
+#include "utils.h"
+#include "mjpg.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -10,45 +12,72 @@
 #define SINGLEFILE_PATH     "video/single"
 #define BILLION             1000000000.f
 #define ITERATIONS          1500
+#define VIDEO_WIDTH         1920
+#define VIDEO_HEIGHT        1080
+#define SCALE               2 // the window is half the size of the video
 
 
-static FILE* fp;
-static FILE* ifp;
+static FILE*      qfp;   // quality of every frame of rate controlled videos, multiple files
+static mjpg_video video; // the single file
+static int        fixed; // the codec refused a quality, stop setting them
 
 
-static int get_frame__multi (int frame, uint8_t* data, size_t* size)
+/**
+ *  Set the quality a rate controlled frame was encoded with, 0 if not.
+ */
+static void set_quality (int quality)
 {
-    char path[256] = {0};
-    sprintf (path, "%s/%d.jpg", MULTIFILES_PATH, frame + 1);
-    fp = fopen (path, "rb");
-    fseek (fp, 0, SEEK_END);
-    *size = ftell (fp);
-    fseek (fp, 0, SEEK_SET);
-    fread (data, *size, 1, fp);
-    fclose (fp);
-    return 0;
+    if (fixed || quality == 0)
+        return;
+    if (jpeg_set_option (JPEG_OPTION_QUALITY, quality) != 0)
+    {
+        fprintf (stderr, "the video is rate controlled but the codec has fixed quantization\n");
+        fixed = 1;
+    }
 }
 
-
-static int get_frame__single (int frame, uint8_t* data, size_t* size)
+static void set_frame_quality (int frame)
 {
-    int pos, s;
-    fseek (ifp, frame * sizeof (int) * 2, SEEK_SET);
-    fread (&pos, 1, sizeof (int), ifp);
-    fread (&s, 1, sizeof (int), ifp);
+    if (qfp == NULL)
+        return;
+    fseek (qfp, frame, SEEK_SET);
+    int quality = fgetc (qfp);
+    if (quality != EOF)
+        set_quality (quality);
+}
 
-    *size = s;
 
-    fseek (fp, pos, SEEK_SET);
-    fread (data, *size, 1, fp);
+/**
+ *  Map frame to data without copying it, the view is padded for decoding
+ *  and released with unmap_file.
+ */
+static int get_frame__multi (int frame, uint8_t** data, size_t* size)
+{
+    char path[256] = {0};
+    sprintf (path, "%s/%d.jpg", MULTIFILES_PATH, frame + 1);
+    set_frame_quality (frame);
+    return map_file (path, (void**) data, size);
+}
 
+
+/**
+ *  Point data at frame in the mapped container, no syscalls or copies.
+ *  Returns non-zero past the last frame or if the frame is corrupt.
+ */
+static int get_frame__single (int frame, uint8_t** data, size_t* size)
+{
+    if (frame >= video.header->frames || mjpg_verify (&video, frame) != 0)
+        return 1;
+    set_quality (video.table[frame].quality);
+    *data = mjpg_frame (&video, frame, size);
     return 0;
 }
 
 
 static int play_multi ()
 {
-    uint8_t* jpeg_data = malloc (1920 * 1080 * 2);
+    qfp = fopen (MULTIFILES_PATH"/quality", "rb");
+    uint8_t* jpeg_data;
     size_t size;
 
     struct timespec uno, dos;
@@ -60,8 +89,11 @@ static int play_multi ()
     for (int i = 0; i < ITERATIONS; i ++)
     {
         clock_gettime (CLOCK_MONOTONIC, &uno);
-        get_frame__multi (i, jpeg_data, &size);
-        jpeg_decompress_to_texture (jpeg_data, size, 0);
+        if (get_frame__multi (i, &jpeg_data, &size) == 0)
+        {
+            jpeg_decompress_to_texture (jpeg_data, size, 0);
+            unmap_file (jpeg_data, size);
+        }
         clock_gettime (CLOCK_MONOTONIC, &dos);
         draw_ui ();
 
@@ -83,7 +115,8 @@ static int play_multi ()
     printf ("  fps:           %6.4f  \n", (double) 1.0 / (total_duration / BILLION / ITERATIONS));
     printf ("\n");
 
-    free (jpeg_data);
+    if (qfp)
+        fclose (qfp);
 
     return 0;
 }
@@ -91,9 +124,12 @@ static int play_multi ()
 
 static int play_single ()
 {
-    fp  = fopen (SINGLEFILE_PATH"/video.mjpg", "rb");
-    ifp = fopen (SINGLEFILE_PATH"/index", "rb");
-    uint8_t* jpeg_data = malloc (1920 * 1080 * 2);
+    if (mjpg_open (&video, SINGLEFILE_PATH"/video.mjpg") != 0)
+    {
+        fprintf (stderr, "could not open %s\n", SINGLEFILE_PATH"/video.mjpg");
+        return 1;
+    }
+    uint8_t* jpeg_data;
     size_t size;
 
     struct timespec uno, dos;
@@ -105,8 +141,8 @@ static int play_single ()
     for (int i = 0; i < ITERATIONS; i ++)
     {
         clock_gettime (CLOCK_MONOTONIC, &uno);
-        get_frame__single (i, jpeg_data, &size);
-        jpeg_decompress_to_texture (jpeg_data, size, 0);
+        if (get_frame__single (i, &jpeg_data, &size) == 0)
+            jpeg_decompress_to_texture (jpeg_data, size, 0);
         clock_gettime (CLOCK_MONOTONIC, &dos);
         draw_ui ();
 
@@ -128,9 +164,7 @@ static int play_single ()
     printf ("  fps:           %6.4f  \n", (double) 1.0 / (total_duration / BILLION / ITERATIONS));
     printf ("\n");
 
-    fclose (fp);
-    fclose (ifp);
-    free (jpeg_data);
+    mjpg_close (&video);
     return 0;
 }
 
@@ -139,8 +173,15 @@ static int play_single ()
 int main (int argc, char** argv)
 {
     int ret;
-    init_ui (960, 540);
-    jpeg_init (1920, 1080, 0);
+    int scale = SCALE;
+    // skip decoding what is not shown, the window is as large as the frames decoded
+    if (jpeg_set_option (JPEG_OPTION_SCALE, scale) != 0)
+    {
+        fprintf (stderr, "the codec can not decode at 1/%d of the size, decoding full frames\n", scale);
+        scale = 1;
+    }
+    if (init_ui (VIDEO_WIDTH / scale, VIDEO_HEIGHT / scale) != 0 || jpeg_init (VIDEO_WIDTH, VIDEO_HEIGHT, 0) != 0)
+        return 1;
 
     if (strcmp (argv[1], "multi") == 0)
     {
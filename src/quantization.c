@@ -0,0 +1,105 @@
+#include "quantization.h"
+
+
+/* quantization tables of the JPEG standard (Annex K.1), quality 50 */
+static const uint8_t standard_tables[2][64] =
+{
+    {
+        16,  11,  10,  16,  24,  40,  51,  61,
+        12,  12,  14,  19,  26,  58,  60,  55,
+        14,  13,  16,  24,  40,  57,  69,  56,
+        14,  17,  22,  29,  51,  87,  80,  62,
+        18,  22,  37,  56,  68, 109, 103,  77,
+        24,  35,  55,  64,  81, 104, 113,  92,
+        49,  64,  78,  87, 103, 121, 120, 101,
+        72,  92,  95,  98, 112, 100, 103,  99
+    },
+    {
+        17,  18,  24,  47,  99,  99,  99,  99,
+        18,  21,  26,  66,  99,  99,  99,  99,
+        24,  26,  56,  99,  99,  99,  99,  99,
+        47,  66,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99
+    }
+};
+
+
+/* default table of both luma and chroma, about quality 95, fixed in the asm and hw codecs */
+static const uint8_t default_table[64] =
+{
+     8,   5,   5,   8,  12,  20,  25,  30,
+     6,   6,   7,   9,  13,  29,  30,  27,
+     7,   6,   8,  12,  20,  28,  34,  28,
+     7,   8,  11,  14,  25,  43,  40,  31,
+     9,  11,  18,  28,  34,  54,  51,  38,
+    12,  17,  27,  32,  40,  52,  56,  46,
+    24,  32,  39,  43,  51,  60,  60,  50,
+    36,  46,  47,  45,  56,  50,  51,  49
+};
+
+
+void quantization_table (int quality, int component, uint16_t table[64])
+{
+    int scale, step;
+
+    if (quality == 0)
+    {
+        for (int i = 0; i < 64; i ++)
+            table[i] = default_table[i];
+        return;
+    }
+    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+    scale   = quality < 50 ? 5000 / quality : 200 - (quality << 1);
+    for (int i = 0; i < 64; i ++)
+    {
+        step     = (standard_tables[component][i] * scale + 50) / 100;
+        table[i] = step < 1 ? 1 : step > 255 ? 255 : step;
+    }
+}
+
+
+int quantization_divisors (const uint16_t table[64], uint16_t divisors[4][64])
+{
+    uint32_t reciprocal, remainder;
+    int      b, r, scalar = 0;
+
+    for (int i = 0; i < 64; i ++)
+    {
+        uint16_t d = table[i];
+        if (d == 1)
+        {
+            // the identity, only with the shift
+            divisors[QUANTIZATION_RECIPROCAL][i] = 1;
+            divisors[QUANTIZATION_CORRECTION][i] = 0;
+            divisors[QUANTIZATION_SCALE][i]      = 1;
+            divisors[QUANTIZATION_SHIFT][i]      = 0;
+            scalar = 1;
+            continue;
+        }
+        // 2^b <= d < 2^(b + 1), the reciprocal 2^r / d has 16 significant bits
+        for (b = 0; (d >> (b + 1)) != 0; b ++) ;
+        r          = 16 + b;
+        reciprocal = (1u << r) / d;
+        remainder  = (1u << r) % d;
+        divisors[QUANTIZATION_CORRECTION][i] = d >> 1;
+        if (remainder == 0)
+        {
+            // power of two, 2^r / d does not fit in 16 bits
+            reciprocal >>= 1;
+            r --;
+        }
+        else if (remainder <= (d >> 1))
+            divisors[QUANTIZATION_CORRECTION][i] ++; // rounded down reciprocal, bias the dividend
+        else
+            reciprocal ++;
+        divisors[QUANTIZATION_RECIPROCAL][i] = reciprocal;
+        divisors[QUANTIZATION_SCALE][i]      = r > 16 ? 1 << (32 - r) : 0;
+        divisors[QUANTIZATION_SHIFT][i]      = r;
+        if (r <= 16)
+            scalar = 1;
+    }
+    return scalar;
+}
@@ -55,6 +55,28 @@ const int q[8][8] =
 shared float transformed[8][8];
 
 
+/**
+ *  First coefficient of the block holding invocation x, y of the width x
+ *  2 * height frame of Y above U and V. Blocks are 64 contiguous coefficients
+ *  in rows, the Y blocks in raster order followed by the U and then the V blocks.
+ */
+uint block_offset (uint x, uint y)
+{
+    uint n;
+    if (y < height)
+        n = (y >> 3) * (width >> 3) + (x >> 3);
+    else
+    {
+        n = (height >> 3) * (width >> 3) + ((y - height) >> 3) * (width >> 4);
+        if (x < (width >> 1))
+            n += x >> 3;
+        else
+            n += (height >> 3) * (width >> 4) + ((x - (width >> 1)) >> 3);
+    }
+    return n << 6;
+}
+
+
 void main ()
 {
     uint gx = gl_GlobalInvocationID.x;
@@ -64,12 +86,13 @@ void main ()
     uint ly = gl_LocalInvocationID.y;
 
     // dequantize
-    data[gy * width + gx] *= int16_t (q[ly][lx]);
+    uint block = block_offset (gx, gy);
+    data[block + (ly << 3) + lx] *= int16_t (q[ly][lx]);
     barrier ();
 
     // multiply Ct
     float v = 0.f;
-    for (uint i = 0, j = gx + (gy & ~7) * width; i < 8; i ++, j += width)
+    for (uint i = 0, j = block + lx; i < 8; i ++, j += 8)
         v += c[i][ly] * data[j];
     transformed[ly][lx] = v;
     barrier ();
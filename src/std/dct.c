@@ -51,6 +51,28 @@
 
 #define Ga4_sqr2    0.500000000000001
 
+/**
+ *  Fixed point constants for the integer transform.
+ *  FIX(x) = round(x * 2^CONST_BITS)
+ */
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
 /**
  *  Vector operators.
  *  ADD, SUB, INV and MUL by a coefficient.
@@ -344,6 +366,258 @@ void ifdct2 (int16_t* block, float destination[BLOCK_SIZE][BLOCK_SIZE])
 }
 
 
+/**
+ *  Arai, Agui & Nakajima 1-D inverse transform.
+ *  Reads 8 values from src every stride elements and writes them with the
+ *  same stride to destination. The input must already be multiplied by the
+ *  scale factors of ifdct2_scale_table.
+ */
+static inline void iaan1 (const float* src, int stride, float* destination)
+{
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13;
+    float z5, z10, z11, z12, z13;
+
+    // even part
+    tmp0 = src[0];
+    tmp1 = src[2 * stride];
+    tmp2 = src[4 * stride];
+    tmp3 = src[6 * stride];
+
+    tmp10 = tmp0 + tmp2;
+    tmp11 = tmp0 - tmp2;
+    tmp13 = tmp1 + tmp3;
+    tmp12 = (tmp1 - tmp3) * SQR2 - tmp13;
+
+    tmp0 = tmp10 + tmp13;
+    tmp3 = tmp10 - tmp13;
+    tmp1 = tmp11 + tmp12;
+    tmp2 = tmp11 - tmp12;
+
+    // odd part
+    tmp4 = src[1 * stride];
+    tmp5 = src[3 * stride];
+    tmp6 = src[5 * stride];
+    tmp7 = src[7 * stride];
+
+    z13 = tmp6 + tmp5;
+    z10 = tmp6 - tmp5;
+    z11 = tmp4 + tmp7;
+    z12 = tmp4 - tmp7;
+
+    tmp7  = z11 + z13;
+    tmp11 = (z11 - z13) * SQR2;
+    z5    = (z10 + z12) * (2 * Ga2);
+    tmp10 = z12 * (2 * (Ga2 - Ga6)) - z5;
+    tmp12 = z10 * (-2 * (Ga2 + Ga6)) + z5;
+
+    tmp6 = tmp12 - tmp7;
+    tmp5 = tmp11 - tmp6;
+    tmp4 = tmp10 + tmp5;
+
+    destination[0]          = tmp0 + tmp7;
+    destination[7 * stride] = tmp0 - tmp7;
+    destination[1 * stride] = tmp1 + tmp6;
+    destination[6 * stride] = tmp1 - tmp6;
+    destination[2 * stride] = tmp2 + tmp5;
+    destination[5 * stride] = tmp2 - tmp5;
+    destination[4 * stride] = tmp3 + tmp4;
+    destination[3 * stride] = tmp3 - tmp4;
+}
+
+
+/**
+ *  iaan1 for input where only the first 4 values can be nonzero.
+ */
+static inline void iaan1_4 (const float* src, int stride, float* destination)
+{
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12;
+    float z5;
+
+    // even part, src[4] and src[6] are zero
+    tmp10 = src[0];
+    tmp12 = src[2 * stride] * (SQR2 - 1);
+
+    tmp0 = tmp10 + src[2 * stride];
+    tmp3 = tmp10 - src[2 * stride];
+    tmp1 = tmp10 + tmp12;
+    tmp2 = tmp10 - tmp12;
+
+    // odd part, src[5] and src[7] are zero
+    tmp4 = src[1 * stride];
+    tmp5 = src[3 * stride];
+
+    tmp7  = tmp4 + tmp5;
+    tmp11 = (tmp4 - tmp5) * SQR2;
+    z5    = (tmp4 - tmp5) * (2 * Ga2);
+    tmp10 = tmp4 * (2 * (Ga2 - Ga6)) - z5;
+    tmp12 = tmp5 * (2 * (Ga2 + Ga6)) + z5;
+
+    tmp6 = tmp12 - tmp7;
+    tmp5 = tmp11 - tmp6;
+    tmp4 = tmp10 + tmp5;
+
+    destination[0]          = tmp0 + tmp7;
+    destination[7 * stride] = tmp0 - tmp7;
+    destination[1 * stride] = tmp1 + tmp6;
+    destination[6 * stride] = tmp1 - tmp6;
+    destination[2 * stride] = tmp2 + tmp5;
+    destination[5 * stride] = tmp2 - tmp5;
+    destination[4 * stride] = tmp3 + tmp4;
+    destination[3 * stride] = tmp3 - tmp4;
+}
+
+void ifdct2_scale_table (const float* q, float* destination)
+{
+    // cos (pi * k / 16) * sqrt (2), 1 for k = 0
+    static const float aan[BLOCK_SIZE] =
+    {
+        1.0,       Ga1 * SQR2, Ga2 * SQR2, Ga3 * SQR2,
+        Ga4 * SQR2, Ga5 * SQR2, Ga6 * SQR2, Ga7 * SQR2
+    };
+    // also fold in the factor 1/8 of the 2-D transform
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+        for (int j = 0; j < BLOCK_SIZE; j ++)
+            destination[(i << 3) + j] = q[(i << 3) + j] * aan[i] * aan[j] * 0.125f;
+}
+
+
+void ifdct2_scaled (int16_t* block, const float* q, uint8_t destination[BLOCK_SIZE][BLOCK_SIZE])
+{
+    float col[BLOCK_TSIZE];
+    float row[BLOCK_SIZE];
+
+    // dequantize and scale while converting to floats
+    for (int i = 0; i < BLOCK_TSIZE; i ++)
+        col[i] = block[i] * q[i];
+    // transform columns
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+        iaan1 (col + i, BLOCK_SIZE, col + i);
+    // transform rows
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+    {
+        // level shift and rounding go in with the DC term which reaches every output once
+        col[i << 3] += 128.5f;
+        iaan1 (col + (i << 3), 1, row);
+        for (int j = 0; j < BLOCK_SIZE; j ++)
+            destination[i][j] = row[j] >= 256 ? 255 : row[j] < 0 ? 0 : (uint8_t) row[j];
+    }
+}
+
+
+void ifdct2_scaled_4x4 (int16_t* block, const float* q, uint8_t destination[BLOCK_SIZE][BLOCK_SIZE])
+{
+    float col[BLOCK_TSIZE];
+    float row[BLOCK_SIZE];
+
+    // dequantize and scale the low frequencies
+    for (int i = 0; i < 4; i ++)
+        for (int j = 0; j < 4; j ++)
+            col[(i << 3) + j] = block[(i << 3) + j] * q[(i << 3) + j];
+    // transform the 4 columns holding data
+    for (int i = 0; i < 4; i ++)
+        iaan1_4 (col + i, BLOCK_SIZE, col + i);
+    // transform rows
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+    {
+        col[i << 3] += 128.5f;
+        iaan1_4 (col + (i << 3), 1, row);
+        for (int j = 0; j < BLOCK_SIZE; j ++)
+            destination[i][j] = row[j] >= 256 ? 255 : row[j] < 0 ? 0 : (uint8_t) row[j];
+    }
+}
+
+/**
+ *  Loeffler, Ligtenberg & Moschytz 1-D inverse transform in fixed point.
+ *  Reads 8 values from src every stride elements and writes them descaled
+ *  by shift bits to destination.
+ *  All intermediates of a valid block fit in 16 bits before the multiplications
+ *  so the same arithmetic can be done in 16-bit SIMD lanes with 32-bit products.
+ */
+static inline void iidct1 (const int32_t* src, int stride, int32_t destination[BLOCK_SIZE], int shift)
+{
+    int32_t tmp0, tmp1, tmp2, tmp3;
+    int32_t tmp10, tmp11, tmp12, tmp13;
+    int32_t z1, z2, z3, z4, z5;
+
+    // even part
+    z2   = src[2 * stride];
+    z3   = src[6 * stride];
+    z1   = (z2 + z3) * FIX_0_541196100;
+    tmp2 = z1 - z3 * FIX_1_847759065;
+    tmp3 = z1 + z2 * FIX_0_765366865;
+
+    z2   = src[0];
+    z3   = src[4 * stride];
+    tmp0 = (z2 + z3) * (1 << CONST_BITS);
+    tmp1 = (z2 - z3) * (1 << CONST_BITS);
+
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    // odd part
+    tmp0 = src[7 * stride];
+    tmp1 = src[5 * stride];
+    tmp2 = src[3 * stride];
+    tmp3 = src[1 * stride];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    z4 = tmp1 + tmp3;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp0 *= FIX_0_298631336;
+    tmp1 *= FIX_2_053119869;
+    tmp2 *= FIX_3_072711026;
+    tmp3 *= FIX_1_501321110;
+    z1   *= - FIX_0_899976223;
+    z2   *= - FIX_2_562915447;
+    z3    = z3 * - FIX_1_961570560 + z5;
+    z4    = z4 * - FIX_0_390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    destination[0] = DESCALE (tmp10 + tmp3, shift);
+    destination[7] = DESCALE (tmp10 - tmp3, shift);
+    destination[1] = DESCALE (tmp11 + tmp2, shift);
+    destination[6] = DESCALE (tmp11 - tmp2, shift);
+    destination[2] = DESCALE (tmp12 + tmp1, shift);
+    destination[5] = DESCALE (tmp12 - tmp1, shift);
+    destination[3] = DESCALE (tmp13 + tmp0, shift);
+    destination[4] = DESCALE (tmp13 - tmp0, shift);
+}
+
+
+void iidct2 (int16_t* block, uint8_t destination[BLOCK_SIZE][BLOCK_SIZE])
+{
+    int32_t col[BLOCK_TSIZE];
+    int32_t tmp[BLOCK_SIZE][BLOCK_SIZE];
+    int32_t row[BLOCK_SIZE];
+
+    for (int i = 0; i < BLOCK_TSIZE; i ++)
+        col[i] = block[i];
+    // transform columns, keeping PASS1_BITS of extra precision
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+        iidct1 (col + i, BLOCK_SIZE, tmp[i], CONST_BITS - PASS1_BITS);
+    // transform rows, removing the extra precision and the factor 8 of the 2-D transform
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+    {
+        for (int j = 0; j < BLOCK_SIZE; j ++)
+            col[j] = tmp[j][i];
+        iidct1 (col, 1, row, CONST_BITS + PASS1_BITS + 3);
+        for (int j = 0; j < BLOCK_SIZE; j ++)
+            destination[i][j] = row[j] > 255 ? 255 : row[j] < 0 ? 0 : row[j];
+    }
+}
+
+
 /**
  *  Multiply a 2-point vector by G2.
  */
@@ -627,3 +901,55 @@ void fdct (int16_t* block, float destination[BLOCK_SIZE][BLOCK_SIZE])
         for (int j = 0; j < BLOCK_SIZE; j ++)
             destination[i][j] = y[j][i];
 }
+
+
+/*
+ *  Bases of the reduced inverse transforms, [x][u] = c(u) / 2 * cos ((2x + 1) u pi / 2N)
+ *  with c(0) = 1 / sqrt (2), so the DC is scaled by 1/8 as in the 8-point transform.
+ */
+static const float reduced_1[1][1] =
+{
+    { Ga4__2 }
+};
+
+static const float reduced_2[2][2] =
+{
+    { Ga4__2,  Ga4__2 },
+    { Ga4__2, -Ga4__2 }
+};
+
+static const float reduced_4[4][4] =
+{
+    { Ga4__2,  Ga2__2,  Ga4__2,  Ga6__2 },
+    { Ga4__2,  Ga6__2, -Ga4__2, -Ga2__2 },
+    { Ga4__2, -Ga6__2, -Ga4__2,  Ga2__2 },
+    { Ga4__2, -Ga2__2,  Ga4__2, -Ga6__2 }
+};
+
+
+void ifdct2_reduced (int16_t* block, const float* q, int size, uint8_t destination[BLOCK_SIZE][BLOCK_SIZE])
+{
+    const float* m = size == 4 ? &reduced_4[0][0] : size == 2 ? &reduced_2[0][0] : &reduced_1[0][0];
+    float tmp[4][4];
+    float v;
+    int x, y, u;
+
+    // transform the rows of the lowest frequencies, dequantizing while loading
+    for (y = 0; y < size; y ++)
+        for (x = 0; x < size; x ++)
+        {
+            v = 0;
+            for (u = 0; u < size; u ++)
+                v += m[x * size + u] * block[(y << 3) + u] * q[(y << 3) + u];
+            tmp[y][x] = v;
+        }
+    // transform the columns, level shift and clamp
+    for (y = 0; y < size; y ++)
+        for (x = 0; x < size; x ++)
+        {
+            v = 128.5f;
+            for (u = 0; u < size; u ++)
+                v += m[y * size + u] * tmp[u][x];
+            destination[y][x] = v >= 256 ? 255 : v < 0 ? 0 : (uint8_t) v;
+        }
+}
@@ -0,0 +1,385 @@
+#include "dct.h"
+#include <immintrin.h>
+
+
+#define BLOCK_SIZE  8
+#define BLOCK_TSIZE 64
+
+/**
+ *  Fixed point constants of iidct2, FIX(x) = round(x * 2^CONST_BITS).
+ */
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+/**
+ *  Constants.
+ *  ga(x) = cos (pi * x / 16) / 2
+ */
+#define ga1         0.490392640201615
+#define ga2         0.461939766255643
+#define ga3         0.415734806151272
+#define ga4         0.353553390593274
+#define ga5         0.277785116509801
+#define ga6         0.191341716182545
+#define ga7         0.097545161008064
+
+/* C matrix for making transformations between frequency domain and spatial domain. */
+static const float c[BLOCK_SIZE][BLOCK_SIZE] =
+{
+    { ga4,  ga4,  ga4,  ga4,  ga4,  ga4,  ga4,  ga4 },
+    { ga1,  ga3,  ga5,  ga7, -ga7, -ga5, -ga3, -ga1 },
+    { ga2,  ga6, -ga6, -ga2, -ga2, -ga6,  ga6,  ga2 },
+    { ga3, -ga7, -ga1, -ga5,  ga5,  ga1,  ga7, -ga3 },
+    { ga4, -ga4, -ga4,  ga4,  ga4, -ga4, -ga4,  ga4 },
+    { ga5, -ga1,  ga7,  ga3, -ga3, -ga7,  ga1, -ga5 },
+    { ga6, -ga2,  ga2, -ga6, -ga6,  ga2, -ga2,  ga6 },
+    { ga7, -ga5,  ga3, -ga1,  ga1, -ga3,  ga5, -ga7 }
+};
+
+/* transposed C matrix */
+static const float ct[BLOCK_SIZE][BLOCK_SIZE] =
+{
+    { ga4,  ga1,  ga2,  ga3,  ga4,  ga5,  ga6,  ga7 },
+    { ga4,  ga3,  ga6, -ga7, -ga4, -ga1, -ga2, -ga5 },
+    { ga4,  ga5, -ga6, -ga1, -ga4,  ga7,  ga2,  ga3 },
+    { ga4,  ga7, -ga2, -ga5,  ga4,  ga3, -ga6, -ga1 },
+    { ga4, -ga7, -ga2,  ga5,  ga4, -ga3, -ga6,  ga1 },
+    { ga4, -ga5, -ga6,  ga1, -ga4, -ga7,  ga2, -ga3 },
+    { ga4, -ga3,  ga6,  ga7, -ga4,  ga1, -ga2,  ga5 },
+    { ga4, -ga1,  ga2, -ga3,  ga4, -ga5,  ga6, -ga7 }
+};
+
+
+/**
+ *  Transpose the 8x8 floats held in rows.
+ */
+static inline void transpose (__m256 rows[BLOCK_SIZE])
+{
+    __m256 t0 = _mm256_unpacklo_ps (rows[0], rows[1]);
+    __m256 t1 = _mm256_unpackhi_ps (rows[0], rows[1]);
+    __m256 t2 = _mm256_unpacklo_ps (rows[2], rows[3]);
+    __m256 t3 = _mm256_unpackhi_ps (rows[2], rows[3]);
+    __m256 t4 = _mm256_unpacklo_ps (rows[4], rows[5]);
+    __m256 t5 = _mm256_unpackhi_ps (rows[4], rows[5]);
+    __m256 t6 = _mm256_unpacklo_ps (rows[6], rows[7]);
+    __m256 t7 = _mm256_unpackhi_ps (rows[6], rows[7]);
+
+    __m256 s0 = _mm256_shuffle_ps (t0, t2, _MM_SHUFFLE (1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps (t0, t2, _MM_SHUFFLE (3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps (t1, t3, _MM_SHUFFLE (1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps (t1, t3, _MM_SHUFFLE (3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps (t4, t6, _MM_SHUFFLE (1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps (t4, t6, _MM_SHUFFLE (3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps (t5, t7, _MM_SHUFFLE (1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps (t5, t7, _MM_SHUFFLE (3, 2, 3, 2));
+
+    rows[0] = _mm256_permute2f128_ps (s0, s4, 0x20);
+    rows[1] = _mm256_permute2f128_ps (s1, s5, 0x20);
+    rows[2] = _mm256_permute2f128_ps (s2, s6, 0x20);
+    rows[3] = _mm256_permute2f128_ps (s3, s7, 0x20);
+    rows[4] = _mm256_permute2f128_ps (s0, s4, 0x31);
+    rows[5] = _mm256_permute2f128_ps (s1, s5, 0x31);
+    rows[6] = _mm256_permute2f128_ps (s2, s6, 0x31);
+    rows[7] = _mm256_permute2f128_ps (s3, s7, 0x31);
+}
+
+/**
+ *  Transpose the 8x8 16-bit integers held in each 128-bit lane of rows,
+ *  i.e. two blocks at once.
+ */
+static inline void transpose_epi16 (__m256i rows[BLOCK_SIZE])
+{
+    __m256i t0 = _mm256_unpacklo_epi16 (rows[0], rows[1]);
+    __m256i t1 = _mm256_unpackhi_epi16 (rows[0], rows[1]);
+    __m256i t2 = _mm256_unpacklo_epi16 (rows[2], rows[3]);
+    __m256i t3 = _mm256_unpackhi_epi16 (rows[2], rows[3]);
+    __m256i t4 = _mm256_unpacklo_epi16 (rows[4], rows[5]);
+    __m256i t5 = _mm256_unpackhi_epi16 (rows[4], rows[5]);
+    __m256i t6 = _mm256_unpacklo_epi16 (rows[6], rows[7]);
+    __m256i t7 = _mm256_unpackhi_epi16 (rows[6], rows[7]);
+
+    __m256i s0 = _mm256_unpacklo_epi32 (t0, t2);
+    __m256i s1 = _mm256_unpackhi_epi32 (t0, t2);
+    __m256i s2 = _mm256_unpacklo_epi32 (t1, t3);
+    __m256i s3 = _mm256_unpackhi_epi32 (t1, t3);
+    __m256i s4 = _mm256_unpacklo_epi32 (t4, t6);
+    __m256i s5 = _mm256_unpackhi_epi32 (t4, t6);
+    __m256i s6 = _mm256_unpacklo_epi32 (t5, t7);
+    __m256i s7 = _mm256_unpackhi_epi32 (t5, t7);
+
+    rows[0] = _mm256_unpacklo_epi64 (s0, s4);
+    rows[1] = _mm256_unpackhi_epi64 (s0, s4);
+    rows[2] = _mm256_unpacklo_epi64 (s1, s5);
+    rows[3] = _mm256_unpackhi_epi64 (s1, s5);
+    rows[4] = _mm256_unpacklo_epi64 (s2, s6);
+    rows[5] = _mm256_unpackhi_epi64 (s2, s6);
+    rows[6] = _mm256_unpacklo_epi64 (s3, s7);
+    rows[7] = _mm256_unpackhi_epi64 (s3, s7);
+}
+
+/**
+ *  Multiply the 8x8 matrix m by the block held in rows, i.e. every row of the
+ *  result is a linear combination of the rows with the coefficients of m.
+ */
+static inline void multiply (const float m[BLOCK_SIZE][BLOCK_SIZE], __m256 rows[BLOCK_SIZE])
+{
+    __m256 result[BLOCK_SIZE];
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+    {
+        result[i] = _mm256_mul_ps (_mm256_set1_ps (m[i][0]), rows[0]);
+        for (int k = 1; k < BLOCK_SIZE; k ++)
+            result[i] = _mm256_fmadd_ps (_mm256_set1_ps (m[i][k]), rows[k], result[i]);
+    }
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+        rows[i] = result[i];
+}
+
+/**
+ *  Two 16-bit constants a and b to multiply the pairs interleaved by unpack
+ *  with _mm256_madd_epi16, giving x * a + y * b in 32 bits.
+ */
+static inline __m256i pair (int a, int b)
+{
+    return _mm256_set1_epi32 ((int) ((uint32_t) (uint16_t) a | (uint32_t) (uint16_t) b << 16));
+}
+
+/**
+ *  iidct1 of dct.c on 4 columns of two blocks, from the pairs of inputs
+ *  p = (v0, v4), (v2, v6), (v7, v5) and (v3, v1) interleaved by unpack.
+ *  The multiplications of the odd part are folded into one constant per input
+ *  and output so every sum is two _mm256_madd_epi16, with the same 32-bit
+ *  result as the scalar version.
+ */
+static inline void iidct1_half (const __m256i p[4], __m256i v[BLOCK_SIZE], int shift)
+{
+    __m256i tmp0, tmp1, tmp2, tmp3;
+    __m256i tmp10, tmp11, tmp12, tmp13;
+    const __m128i count = _mm_cvtsi32_si128 (shift);
+    const __m256i round = _mm256_set1_epi32 (1 << (shift - 1));
+
+#define MADD(x, a, b) _mm256_madd_epi16 (x, pair (a, b))
+#define DESCALE(x) _mm256_sra_epi32 (_mm256_add_epi32 (x, round), count)
+
+    // even part
+    tmp0 = MADD (p[0], 1 << CONST_BITS,   1 << CONST_BITS);
+    tmp1 = MADD (p[0], 1 << CONST_BITS, -(1 << CONST_BITS));
+    tmp2 = MADD (p[1], FIX_0_541196100, FIX_0_541196100 - FIX_1_847759065);
+    tmp3 = MADD (p[1], FIX_0_541196100 + FIX_0_765366865, FIX_0_541196100);
+
+    tmp10 = _mm256_add_epi32 (tmp0, tmp3);
+    tmp13 = _mm256_sub_epi32 (tmp0, tmp3);
+    tmp11 = _mm256_add_epi32 (tmp1, tmp2);
+    tmp12 = _mm256_sub_epi32 (tmp1, tmp2);
+
+    // odd part, z1 to z5 expanded into the coefficients of v7, v5, v3 and v1
+    tmp0 = _mm256_add_epi32 (MADD (p[2], FIX_0_298631336 - FIX_0_899976223 - FIX_1_961570560 + FIX_1_175875602, FIX_1_175875602),
+                             MADD (p[3], FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_0_899976223));
+    tmp1 = _mm256_add_epi32 (MADD (p[2], FIX_1_175875602, FIX_2_053119869 - FIX_2_562915447 - FIX_0_390180644 + FIX_1_175875602),
+                             MADD (p[3], FIX_1_175875602 - FIX_2_562915447, FIX_1_175875602 - FIX_0_390180644));
+    tmp2 = _mm256_add_epi32 (MADD (p[2], FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_2_562915447),
+                             MADD (p[3], FIX_3_072711026 - FIX_2_562915447 - FIX_1_961570560 + FIX_1_175875602, FIX_1_175875602));
+    tmp3 = _mm256_add_epi32 (MADD (p[2], FIX_1_175875602 - FIX_0_899976223, FIX_1_175875602 - FIX_0_390180644),
+                             MADD (p[3], FIX_1_175875602, FIX_1_501321110 - FIX_0_899976223 - FIX_0_390180644 + FIX_1_175875602));
+
+    v[0] = DESCALE (_mm256_add_epi32 (tmp10, tmp3));
+    v[7] = DESCALE (_mm256_sub_epi32 (tmp10, tmp3));
+    v[1] = DESCALE (_mm256_add_epi32 (tmp11, tmp2));
+    v[6] = DESCALE (_mm256_sub_epi32 (tmp11, tmp2));
+    v[2] = DESCALE (_mm256_add_epi32 (tmp12, tmp1));
+    v[5] = DESCALE (_mm256_sub_epi32 (tmp12, tmp1));
+    v[3] = DESCALE (_mm256_add_epi32 (tmp13, tmp0));
+    v[4] = DESCALE (_mm256_sub_epi32 (tmp13, tmp0));
+
+#undef MADD
+#undef DESCALE
+}
+
+/**
+ *  iidct1 of dct.c on the 8 columns of the two blocks held in v, v[k] holding
+ *  the k:th value of every column, in 16-bit lanes.
+ *  Returns a nonzero lane if a result did not fit in 16 bits and was saturated.
+ */
+static inline __m256i iidct1_avx2 (__m256i v[BLOCK_SIZE], int shift)
+{
+    __m256i lo[BLOCK_SIZE], hi[BLOCK_SIZE], p[4];
+    __m256i overflow = _mm256_setzero_si256 ();
+    const __m256i bias = _mm256_set1_epi32 (0x8000);
+
+    p[0] = _mm256_unpacklo_epi16 (v[0], v[4]);
+    p[1] = _mm256_unpacklo_epi16 (v[2], v[6]);
+    p[2] = _mm256_unpacklo_epi16 (v[7], v[5]);
+    p[3] = _mm256_unpacklo_epi16 (v[3], v[1]);
+    iidct1_half (p, lo, shift);
+    p[0] = _mm256_unpackhi_epi16 (v[0], v[4]);
+    p[1] = _mm256_unpackhi_epi16 (v[2], v[6]);
+    p[2] = _mm256_unpackhi_epi16 (v[7], v[5]);
+    p[3] = _mm256_unpackhi_epi16 (v[3], v[1]);
+    iidct1_half (p, hi, shift);
+
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+    {
+        // x fits in 16 bits if x + 0x8000 has none of the upper 16 bits set
+        overflow = _mm256_or_si256 (overflow, _mm256_add_epi32 (lo[i], bias));
+        overflow = _mm256_or_si256 (overflow, _mm256_add_epi32 (hi[i], bias));
+        v[i] = _mm256_packs_epi32 (lo[i], hi[i]);
+    }
+    return _mm256_srli_epi32 (overflow, 16);
+}
+
+/**
+ *  Pack two rows of 8 32-bit integers to 16 16-bit integers in order.
+ */
+static inline __m256i pack_rows (__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), _MM_SHUFFLE (3, 1, 2, 0));
+}
+
+
+void fdct_avx2 (int16_t* blocks, int n)
+{
+    __m256 rows[BLOCK_SIZE];
+    const __m256 shift = _mm256_set1_ps (128.f);
+
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE)
+    {
+        // load and level shift
+        for (int i = 0; i < BLOCK_SIZE; i ++)
+        {
+            __m128i row = _mm_loadu_si128 ((__m128i*) (blocks + (i << 3)));
+            rows[i] = _mm256_sub_ps (_mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (row)), shift);
+        }
+        // C X C^t
+        multiply  (c, rows);
+        transpose (rows);
+        multiply  (c, rows);
+        transpose (rows);
+        // round and store
+        for (int i = 0; i < BLOCK_SIZE; i += 2)
+            _mm256_storeu_si256 ((__m256i*) (blocks + (i << 3)), pack_rows (_mm256_cvtps_epi32 (rows[i]), _mm256_cvtps_epi32 (rows[i + 1])));
+    }
+}
+
+
+void quantize_avx2 (int16_t* blocks, int n, const uint16_t* divisors)
+{
+    __m256i reciprocal[4], correction[4], scale[4];
+    __m256i x, sign;
+
+    for (int i = 0; i < 4; i ++)
+    {
+        reciprocal[i] = _mm256_loadu_si256 ((const __m256i*) (divisors + (i << 4)));
+        correction[i] = _mm256_loadu_si256 ((const __m256i*) (divisors + BLOCK_TSIZE + (i << 4)));
+        scale[i]      = _mm256_loadu_si256 ((const __m256i*) (divisors + 2 * BLOCK_TSIZE + (i << 4)));
+    }
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE)
+    {
+        for (int i = 0; i < 4; i ++)
+        {
+            // divide the magnitudes and restore the signs
+            x    = _mm256_loadu_si256 ((__m256i*) (blocks + (i << 4)));
+            sign = _mm256_srai_epi16 (x, 15);
+            x    = _mm256_add_epi16 (_mm256_abs_epi16 (x), correction[i]);
+            x    = _mm256_mulhi_epu16 (_mm256_mulhi_epu16 (x, reciprocal[i]), scale[i]);
+            _mm256_storeu_si256 ((__m256i*) (blocks + (i << 4)), _mm256_sub_epi16 (_mm256_xor_si256 (x, sign), sign));
+        }
+    }
+}
+
+
+void idct_avx2 (int16_t* blocks, int n, const float* q, uint8_t* destination)
+{
+    __m256 rows[BLOCK_SIZE];
+    const __m256  shift = _mm256_set1_ps (128.f);
+    const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE, destination += BLOCK_TSIZE)
+    {
+        // load and dequantize
+        for (int i = 0; i < BLOCK_SIZE; i ++)
+        {
+            __m128i row = _mm_loadu_si128 ((__m128i*) (blocks + (i << 3)));
+            rows[i] = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (row)), _mm256_loadu_ps (q + (i << 3)));
+        }
+        // C^t F C
+        multiply  (ct, rows);
+        transpose (rows);
+        multiply  (ct, rows);
+        transpose (rows);
+        // level shift, round, clamp and pack to bytes four rows at a time
+        for (int i = 0; i < BLOCK_SIZE; i += 4)
+        {
+            __m256i r0 = _mm256_cvtps_epi32 (_mm256_add_ps (rows[i],     shift));
+            __m256i r1 = _mm256_cvtps_epi32 (_mm256_add_ps (rows[i + 1], shift));
+            __m256i r2 = _mm256_cvtps_epi32 (_mm256_add_ps (rows[i + 2], shift));
+            __m256i r3 = _mm256_cvtps_epi32 (_mm256_add_ps (rows[i + 3], shift));
+            __m256i b  = _mm256_packus_epi16 (_mm256_packs_epi32 (r0, r1), _mm256_packs_epi32 (r2, r3));
+            _mm256_storeu_si256 ((__m256i*) (destination + (i << 3)), _mm256_permutevar8x32_epi32 (b, order));
+        }
+    }
+}
+
+
+void iidct_avx2 (int16_t* blocks, int n, const float* q, uint8_t* destination)
+{
+    __m256i rows[BLOCK_SIZE];
+    __m256i matrix[BLOCK_SIZE];
+    const __m256i shift = _mm256_setr_epi16 (1024, 0, 0, 0, 0, 0, 0, 0, 1024, 0, 0, 0, 0, 0, 0, 0);
+
+    // the quantization steps are integers, the same for both blocks
+    for (int i = 0; i < BLOCK_SIZE; i ++)
+    {
+        __m256i m = _mm256_cvttps_epi32 (_mm256_loadu_ps (q + (i << 3)));
+        matrix[i] = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (m, m), _MM_SHUFFLE (2, 0, 2, 0));
+    }
+
+    // two blocks at a time, one per 128-bit lane
+    for ( ; n > 0; n -= 2, blocks += 2 * BLOCK_TSIZE, destination += 2 * BLOCK_TSIZE)
+    {
+        // dequantize and level shift in 16 bits like the scalar version does in the block
+        for (int i = 0; i < BLOCK_SIZE; i ++)
+        {
+            __m128i a = _mm_loadu_si128 ((__m128i*) (blocks + (i << 3)));
+            __m128i b = n > 1 ? _mm_loadu_si128 ((__m128i*) (blocks + BLOCK_TSIZE + (i << 3))) : _mm_setzero_si128 ();
+            rows[i] = _mm256_mullo_epi16 (_mm256_inserti128_si256 (_mm256_castsi128_si256 (a), b, 1), matrix[i]);
+        }
+        rows[0] = _mm256_add_epi16 (rows[0], shift);
+        // columns keeping PASS1_BITS of extra precision, which only overflow
+        // 16 bits for coefficients no encoder produces; iidct2 keeps 32 bits for those
+        if (!_mm256_testz_si256 (iidct1_avx2 (rows, CONST_BITS - PASS1_BITS), _mm256_set1_epi32 (-1)))
+        {
+            for (int k = 0; k < 2 && k < n; k ++)
+            {
+                int16_t block[BLOCK_TSIZE];
+                for (int i = 0; i < BLOCK_TSIZE; i ++)
+                    block[i] = blocks[k * BLOCK_TSIZE + i] * q[i];
+                block[0] += 1024;
+                iidct2 (block, (uint8_t (*)[BLOCK_SIZE]) (destination + k * BLOCK_TSIZE));
+            }
+            continue;
+        }
+        // then rows, the saturation of the last pack being the clamp of iidct2
+        transpose_epi16 (rows);
+        iidct1_avx2     (rows, CONST_BITS + PASS1_BITS + 3);
+        transpose_epi16 (rows);
+        for (int i = 0; i < BLOCK_SIZE; i += 2)
+        {
+            __m256i b = _mm256_packus_epi16 (rows[i], rows[i + 1]);
+            _mm_storeu_si128 ((__m128i*) (destination + (i << 3)), _mm256_castsi256_si128 (b));
+            if (n > 1)
+                _mm_storeu_si128 ((__m128i*) (destination + BLOCK_TSIZE + (i << 3)), _mm256_extracti128_si256 (b, 1));
+        }
+    }
+}
@@ -1,7 +1,13 @@
 #include "jpeg/jpeg.h"
 #include "utils.h"
 #include "huffman.h"
+#include "decode.h"
 #include "dct.h"
+#include "uyvy.h"
+#include "quantization.h"
+#include "trellis.h"
+#include "cpu.h"
+#include "hugepages.h"
 #include "ui.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,57 +15,111 @@
 #include <string.h>
 #ifdef MULTITHREAD
     #include "thread_pool.h"
+    #include "affinity.h"
+    #include <stdint.h>
 #endif
 
 #define BLOCK_TSIZE 64
 #define EOB          0 // End of Block
 #define MEMALIGN    16
-#define ROUND_TO_BYTE(x) x > 255 ? 255 : x < 0 ? 0 : x;
+#define CACHE_LINE  64
+#define BATCH_SIZE   2 // blocks decoded and transformed per call
+#define LAST_LOW_FREQUENCY 9 // last zig zag index inside the top left 4x4 coefficients
 
 
 static int width,
            height;
 
-// luminance and color channels for raw data
+// luminance and color blocks of the strip being encoded
 static int16_t* Y;
 static int16_t* U;
 static int16_t* V;
 
+// entropy coded luma right half, U and V, appended to the left half when a frame is done
+static uint8_t* channel_streams[3];
+static size_t   stream_bytes; // of a channel at its longest, at any quality
+
 static uint8_t* buffer;
 
-static size_t block_byte_size = BLOCK_TSIZE * sizeof (int16_t);
+// decoded pixels, a strip is the 2n blocks of luma then the n blocks of U and of V
+static uint8_t* pixels;
+
+// a strip in the output format for jpeg_decompress_strips
+static uint8_t* strip_buffer;
+
+// set by jpeg_init, the kernels are bound again when their options change after
+static int initialised = 0;
+
+// kernel selection, see bind_kernels
+static int idct_method = JPEG_IDCT_FLOAT;
+static int simd_level  = JPEG_SIMD_BEST;
+
+// decoded frames are 1 / (1 << scale_shift) of the size
+static int scale_shift = 0;
+
+// JPEG_OPTION_QUALITY, 0 for the default table of quantization_table
+static int quality = 0;
+
+// JPEG_OPTION_RDO
+static int rdo = 0;
+
+// JPEG_OPTION_FORMAT and JPEG_OPTION_INPUT_FORMAT
+static int format       = JPEG_FORMAT_UYVY;
+static int input_format = JPEG_FORMAT_UYVY;
 
 #ifdef MULTITHREAD
-static int          running = 1;
+#define NTHREADS 4
+
 static thread_pool  jobs;
 static thread_pool  finished_jobs;
-static pthread_t    thread_1, thread_2, thread_3, thread_4;
+static pthread_t    threads[NTHREADS];
+
+// worker placement
+static int          pin_threads = 0;
+static int          numa_node   = AFFINITY_ANY_NODE;
+static int          cpus[AFFINITY_MAX_CPUS];
+static int          ncpus       = 0;
+
+// channels of each strip decoded, the last one to finish a strip stores it
+static int*         strips_done;
+
+// where the frame being decoded goes and the bits it has, see jpeg_decompress_planes
+static uint8_t*     output_planes[3];
+static int          output_pitches[3];
+static int          stream_end;
+
+#define NSCRATCH (NTHREADS + 1) // the workers, then the calling thread
+#else
+#define NSCRATCH 1
 #endif
 
-/* standard quantization matrix ~ 50% */
-// static float quantization_matrix_50[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE] =
-// {
-//     {  16,  11,  10,  16,  24,  40,  51,  61 },
-//     {  12,  12,  14,  19,  26,  58,  60,  55 },
-//     {  14,  13,  16,  24,  40,  57,  69,  56 },
-//     {  14,  17,  22,  29,  51,  87,  80,  62 },
-//     {  18,  22,  37,  56,  68, 109, 103,  77 },
-//     {  24,  35,  55,  64,  81, 104, 113,  92 },
-//     {  49,  64,  78,  87, 103, 121, 120, 101 },
-//     {  72,  92,  95,  90, 112, 100, 103,  99 }
-// };
-static float quantization_matrix_95[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE] =
-{
-    {   8,   5,   5,   8,  12,  20,  25,  30 },
-    {   6,   6,   7,   9,  13,  29,  30,  27 },
-    {   7,   6,   8,  12,  20,  28,  34,  28 },
-    {   7,   8,  11,  14,  25,  43,  40,  31 },
-    {   9,  11,  18,  28,  34,  54,  51,  38 },
-    {  12,  17,  27,  32,  40,  52,  56,  46 },
-    {  24,  32,  39,  43,  51,  60,  60,  50 },
-    {  36,  46,  47,  45,  56,  50,  51,  49 }
+/**
+ *  Scratch memory of a thread decoding, allocated in jpeg_init and reused for
+ *  every frame. Each one starts on a cache line of its own and spans whole
+ *  lines, so no two threads ever write to the same line.
+ */
+struct scratch
+{
+    int16_t blocks[BATCH_SIZE * BLOCK_TSIZE]; // coefficients of a batch
+} __attribute__ ((aligned (CACHE_LINE)));
+
+static struct scratch* scratch;
+
+/**
+ *  Quantization of a component and the tables derived from it in jpeg_init.
+ */
+struct quantization
+{
+    float    matrix[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE];
+    float    scaled[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE]; // premultiplied by the scale factors of the float IDCT
+    uint16_t divisors[4][BLOCK_TSIZE];                 // see quantization_divisors
+    int      scalar;                                   // divisors can not be used by quantize_avx2
+    float    lambda;                                   // of trellis_quantize
+    int      block_bits;                               // most bits a block takes, huffman_block_bound
 };
 
+static struct quantization quantization[2]; // QUANTIZATION_LUMA, QUANTIZATION_CHROMA
+
 /* specify zig zag order to do entropy encoding in */
 static uint8_t zigzag[JPEG_BLOCK_SIZE * JPEG_BLOCK_SIZE][2] =
 {
@@ -73,11 +133,24 @@ static uint8_t zigzag[JPEG_BLOCK_SIZE * JPEG_BLOCK_SIZE][2] =
     { 5, 6 }, { 4, 7 }, { 5, 7 }, { 6, 6 }, { 7, 5 }, { 7, 6 }, { 6, 7 }, { 7, 7 }
 };
 
+/**
+ *  Most bits encode writes for a block quantized with table.
+ */
+static int block_bound (const uint16_t table[BLOCK_TSIZE])
+{
+    uint16_t steps[BLOCK_TSIZE];
+    for (int i = 0; i < BLOCK_TSIZE; i ++)
+        steps[i] = table[(zigzag[i][1] << 3) + zigzag[i][0]];
+    return huffman_block_bound (steps);
+}
+
+
 #define DECODE_HUFFMAN_AC(buffer, p) decode_huffman_value (huffman_ac_tree, buffer, p)
 #define DECODE_HUFFMAN_DC(buffer, p) decode_huffman_value (huffman_dc_tree, buffer, p)
 
 static struct huffman_tree_node* huffman_ac_tree;
 static struct huffman_tree_node* huffman_dc_tree;
+static uint8_t                   huffman_ac_skip[1 << HUFFMAN_SKIP_BITS];
 
 
 /**
@@ -93,26 +166,31 @@ static void huffman_init ()
     huffman_dc_tree->children[0] = huffman_dc_tree->children[1] = NULL;
     create_huffman_ac_tree (huffman_ac_tree);
     create_huffman_dc_tree (huffman_dc_tree);
+    create_huffman_ac_skip_table (huffman_ac_skip);
 }
 
 /**
- *  Apply quantization to data with q as quantization parameter.
+ *  Quantize the coefficients of a block in place, rounding to nearest, with
+ *  the reciprocals of quantization_divisors. Same results as quantize_avx2.
  */
-static void quantize (float block[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], int16_t* destination)
+static void quantize (int16_t* block, const struct quantization* q)
 {
-    for (int j = 0; j < JPEG_BLOCK_SIZE; j ++)
-        for (int i = 0; i < JPEG_BLOCK_SIZE; i ++)
-            destination[(j << 3) + i] = block[j][i] / quantization_matrix_95[j][i];
+    for (int i = 0; i < BLOCK_TSIZE; i ++)
+    {
+        uint32_t x = block[i] < 0 ? -block[i] : block[i];
+        x = ((x + q->divisors[QUANTIZATION_CORRECTION][i]) * q->divisors[QUANTIZATION_RECIPROCAL][i]) >> q->divisors[QUANTIZATION_SHIFT][i];
+        block[i] = block[i] < 0 ? -(int16_t) x : (int16_t) x;
+    }
 }
 
 /**
  *  Multiply by quantization matrix.
  */
-static void dequantize (int16_t* block)
+static void dequantize (int16_t* block, const struct quantization* q)
 {
     for (int i = 0; i < JPEG_BLOCK_SIZE; i ++)
         for (int j = 0; j < JPEG_BLOCK_SIZE; j ++)
-            block[(i << 3) + j] *= quantization_matrix_95[i][j];
+            block[(i << 3) + j] *= q->matrix[i][j];
 }
 
 /**
@@ -153,11 +231,15 @@ static void encode (int16_t* block, uint8_t* destination, int* p)
 
 /**
  *  Decode entropy data.
+ *  Returns the zig zag index of the last nonzero coefficient, or -1 on a
+ *  corrupt block which is left zeroed.
  */
-static void decode (uint8_t* data, int* p, int16_t* block)
+static int decode (uint8_t* data, int* p, int16_t* block)
 {
     // decode DC coefficient
     uint8_t  symbol    = DECODE_HUFFMAN_DC (data, p);
+    if (symbol == HUFFMAN_INVALID)
+        return -1;
     uint16_t amplitude = read_value (data, p, symbol);
     // check if it was a negative value
     if ((amplitude & (1 << (symbol - 1))) == 0)
@@ -165,345 +247,1034 @@ static void decode (uint8_t* data, int* p, int16_t* block)
     block[0] = amplitude;
 
     // fill rest of block
-    int i = 1;
+    int i = 1, last = 0;
     uint8_t run, size;
     while ((symbol = DECODE_HUFFMAN_AC (data, p)) != EOB)
     {
         run  = symbol >> 4;
         size = symbol & 0xF;
         i   += run; // skip zeroes
+        if (corrupt_code (i, symbol))
+        {
+            clear_block (block, last);
+            return -1;
+        }
         if (size > 0)
         {
             amplitude = read_value (data, p, size);
             if ((amplitude & (1 << (size - 1))) == 0) // handle negative values
                 amplitude = ~((~amplitude) & ~(0xFFFF << size)) + 1;
             block[(zigzag[i][1] << 3) + zigzag[i][0]] = amplitude;
-            i ++;
+            last = i ++;
         }
     }
+    return last;
 }
 
 
-static inline void compress_block (int16_t* block,
-                                   int16_t* previous_dc,
-                                   float coefficients[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE],
-                                   uint8_t* destination,
-                                   int* bufferp)
+/**
+ *  Transform and quantize n consecutive blocks in place.
+ */
+static void transform_blocks (int16_t* blocks, int n, const struct quantization* q)
 {
-    // transform
-    fdct2 (block, coefficients);
-    // quantize
-    coefficients[0][0] -= 1024;
-    quantize (coefficients, block);
-    // remove previous dc
-    int16_t dc = *previous_dc;
-    *previous_dc = block[0];
-    block[0] -= dc;
-    // encode
-    encode (block, destination, bufferp);
+    float coefficients[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE];
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE)
+    {
+        fdct2 (blocks, coefficients);
+        coefficients[0][0] -= 1024;
+        for (int i = 0; i < BLOCK_TSIZE; i ++)
+            blocks[i] = lrintf (coefficients[i >> 3][i & 7]);
+        quantize (blocks, q);
+    }
 }
 
+static void transform_blocks_avx2 (int16_t* blocks, int n, const struct quantization* q)
+{
+    fdct_avx2 (blocks, n);
+    if (!q->scalar)
+        quantize_avx2 (blocks, n, &q->divisors[0][0]);
+    else
+        for ( ; n > 0; n --, blocks += BLOCK_TSIZE)
+            quantize (blocks, q);
+}
 
-static inline void decompress_block (uint8_t* data, int* p, int16_t* block, int16_t* dc, float decompressed[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE])
+/**
+ *  Transform n consecutive blocks in place and quantize them with trellis_quantize.
+ */
+static void transform_blocks_trellis (int16_t* blocks, int n, const struct quantization* q)
+{
+    float coefficients[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE];
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE)
+    {
+        fdct2 (blocks, coefficients);
+        coefficients[0][0] -= 1024;
+        for (int i = 0; i < BLOCK_TSIZE; i ++)
+            blocks[i] = lrintf (coefficients[i >> 3][i & 7]);
+        trellis_quantize (blocks, &q->matrix[0][0], q->lambda);
+    }
+}
+
+static void (*transform) (int16_t*, int, const struct quantization*) = transform_blocks;
+
+
+static inline void compress_blocks (int16_t* blocks,
+                                    int n,
+                                    const struct quantization* q,
+                                    int16_t* previous_dc,
+                                    uint8_t* destination,
+                                    int* bufferp)
+{
+    // transform and quantize
+    transform (blocks, n, q);
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE)
+    {
+        // remove previous dc
+        int16_t dc = *previous_dc;
+        *previous_dc = blocks[0];
+        blocks[0] -= dc;
+        // encode
+        encode (blocks, destination, bufferp);
+    }
+}
+
+
+/**
+ *  Fill the pixels of a block with only a DC coefficient with the constant value.
+ */
+static inline void fill_block (int value, uint8_t pixels[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE])
+{
+    memset (pixels, value > 255 ? 255 : value < 0 ? 0 : value, BLOCK_TSIZE);
+}
+
+/**
+ *  Inverse transforms selectable through JPEG_OPTION_IDCT.
+ *  Both take a quantized block with the zig zag index of its last nonzero
+ *  coefficient and store the pixels clamped to bytes. Blocks with only a DC
+ *  coefficient are filled with a constant and, for the float transform, blocks
+ *  with only the lowest frequencies are transformed with a 4x4 kernel.
+ */
+static void idct_float (int16_t* block, int last, uint8_t pixels[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization* q)
+{
+    if (last == 0)
+        fill_block ((int) floorf (block[0] * q->scaled[0][0] + 128.5f), pixels);
+    else if (last <= LAST_LOW_FREQUENCY)
+        ifdct2_scaled_4x4 (block, &q->scaled[0][0], pixels);
+    else
+        ifdct2_scaled (block, &q->scaled[0][0], pixels);
+}
+
+static void idct_int (int16_t* block, int last, uint8_t pixels[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization* q)
+{
+    dequantize (block, q);
+    block[0] += 1024;
+    if (last == 0)
+        fill_block ((block[0] + 4) >> 3, pixels);
+    else
+        iidct2 (block, pixels);
+}
+
+static void (*inverse_transform) (int16_t*, int, uint8_t[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization*) = idct_float;
+
+/**
+ *  Inverse transform n consecutive quantized blocks to pixels.
+ */
+static void reconstruct_blocks (int16_t* blocks, const int* last, int n, uint8_t pixels[][JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization* q)
+{
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE, last ++, pixels ++)
+        inverse_transform (blocks, *last, *pixels, q);
+}
+
+static void reconstruct_blocks_avx2 (int16_t* blocks, const int* last, int n, uint8_t pixels[][JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization* q)
+{
+    int k, i;
+    // transform runs of blocks with AC coefficients together
+    for (k = 0; k < n; k = i)
+    {
+        if (last[k] == 0)
+        {
+            fill_block ((int) floorf (blocks[k * BLOCK_TSIZE] * q->scaled[0][0] + 128.5f), pixels[k]);
+            i = k + 1;
+            continue;
+        }
+        for (i = k + 1; i < n && last[i] != 0; i ++) ;
+        idct_avx2 (blocks + k * BLOCK_TSIZE, i - k, &q->matrix[0][0], &pixels[k][0][0]);
+    }
+}
+
+static void reconstruct_blocks_int_avx2 (int16_t* blocks, const int* last, int n, uint8_t pixels[][JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization* q)
+{
+    int k, i;
+    for (k = 0; k < n; k = i)
+    {
+        if (last[k] == 0)
+        {
+            idct_int (blocks + k * BLOCK_TSIZE, 0, pixels[k], q);
+            i = k + 1;
+            continue;
+        }
+        for (i = k + 1; i < n && last[i] != 0; i ++) ;
+        iidct_avx2 (blocks + k * BLOCK_TSIZE, i - k, &q->matrix[0][0], &pixels[k][0][0]);
+    }
+}
+
+/**
+ *  Inverse transform n consecutive quantized blocks to reduced size pixels
+ *  in the top left corner of each block of pixels.
+ */
+static void reconstruct_blocks_reduced (int16_t* blocks, const int* last, int n, uint8_t pixels[][JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization* q)
+{
+    for ( ; n > 0; n --, blocks += BLOCK_TSIZE, last ++, pixels ++)
+    {
+        if (*last == 0)
+            fill_block ((int) floorf (blocks[0] * q->scaled[0][0] + 128.5f), *pixels);
+        else
+            ifdct2_reduced (blocks, &q->matrix[0][0], JPEG_BLOCK_SIZE >> scale_shift, *pixels);
+    }
+}
+
+static void (*reconstruct) (int16_t*, const int*, int, uint8_t[][JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE], const struct quantization*) = reconstruct_blocks;
+
+/**
+ *  Byte offset of channel c (0 and 1 the luma halves, 2 U, 3 V) in a strip of
+ *  pixels, and the quantization it is decoded with.
+ */
+#define CHANNEL_OFFSET(c)       ((c) * (width >> 4) * BLOCK_TSIZE)
+#define CHANNEL_QUANTIZATION(c) (&quantization[(c) < 2 ? QUANTIZATION_LUMA : QUANTIZATION_CHROMA])
+
+/**
+ *  Pixel x of row i of a strip of blocks decoded at size x size pixels.
+ */
+static inline uint8_t strip_pixel (const uint8_t* blocks, int size, int x, int i)
+{
+    return blocks[((x / size) << 6) + (i << 3) + x % size];
+}
+
+static inline uint8_t clamp_byte (int value)
+{
+    return value > 255 ? 255 : value < 0 ? 0 : value;
+}
+
+/**
+ *  Stores of a decoded strip of 8 rows, the 2n luma blocks Y and the n blocks
+ *  of U and V decoded at size x size pixels, to the rows of the output planes
+ *  in one pass, one per JPEG_FORMAT_*. See uyvy_store_sse41 for the planes.
+ */
+static void store_uyvy (int size, const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    for (int i = 0; i < size; i ++)
+    {
+        uint8_t* d = planes[0] + i * strides[0];
+        for (int x = 0; x < n * size; x ++, d += 4)
+        {
+            d[0] = strip_pixel (U, size, x, i);
+            d[1] = strip_pixel (Y, size, 2 * x, i);
+            d[2] = strip_pixel (V, size, x, i);
+            d[3] = strip_pixel (Y, size, 2 * x + 1, i);
+        }
+    }
+}
+
+static void store_i422 (int size, const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    for (int i = 0; i < size; i ++)
+        for (int x = 0; x < n * size; x ++)
+        {
+            planes[0][i * strides[0] + 2 * x]     = strip_pixel (Y, size, 2 * x, i);
+            planes[0][i * strides[0] + 2 * x + 1] = strip_pixel (Y, size, 2 * x + 1, i);
+            planes[1][i * strides[1] + x]         = strip_pixel (U, size, x, i);
+            planes[2][i * strides[2] + x]         = strip_pixel (V, size, x, i);
+        }
+}
+
+static void store_nv16 (int size, const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    for (int i = 0; i < size; i ++)
+        for (int x = 0; x < n * size; x ++)
+        {
+            planes[0][i * strides[0] + 2 * x]     = strip_pixel (Y, size, 2 * x, i);
+            planes[0][i * strides[0] + 2 * x + 1] = strip_pixel (Y, size, 2 * x + 1, i);
+            planes[1][i * strides[1] + 2 * x]     = strip_pixel (U, size, x, i);
+            planes[1][i * strides[1] + 2 * x + 1] = strip_pixel (V, size, x, i);
+        }
+}
+
+/**
+ *  Convert the strip to RGB of bpp bytes per pixel, with opaque alpha for 4.
+ */
+static inline void store_rgb (int size, const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* destination, int stride, int bpp)
+{
+    int c, u, v;
+
+    for (int i = 0; i < size; i ++)
+    {
+        uint8_t* d = destination + i * stride;
+        for (int x = 0; x < 2 * n * size; x ++, d += bpp)
+        {
+            c    = YUV_RGB_Y * (strip_pixel (Y, size, x, i) - 16) + 128;
+            u    = strip_pixel (U, size, x >> 1, i) - 128;
+            v    = strip_pixel (V, size, x >> 1, i) - 128;
+            d[0] = clamp_byte ((c + YUV_RGB_RV * v) >> 8);
+            d[1] = clamp_byte ((c + YUV_RGB_GU * u + YUV_RGB_GV * v) >> 8);
+            d[2] = clamp_byte ((c + YUV_RGB_BU * u) >> 8);
+            if (bpp == 4)
+                d[3] = 255;
+        }
+    }
+}
+
+static void store_rgb24 (int size, const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    store_rgb (size, Y, U, V, n, planes[0], strides[0], 3);
+}
+
+static void store_rgba (int size, const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    store_rgb (size, Y, U, V, n, planes[0], strides[0], 4);
+}
+
+// by JPEG_FORMAT_*
+static void (*const stores[]) (int, const uint8_t*, const uint8_t*, const uint8_t*, int, uint8_t* const[3], const int[3]) =
+{
+    store_uyvy, store_i422, store_nv16, store_rgb24, store_rgba
+};
+
+/**
+ *  Store in the output format at the decoded scale.
+ */
+static void store_scaled (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    stores[format] (JPEG_BLOCK_SIZE >> scale_shift, Y, U, V, n, planes, strides);
+}
+
+static void (*store) (const uint8_t*, const uint8_t*, const uint8_t*, int, uint8_t* const[3], const int[3]) = store_scaled;
+
+/**
+ *  The planes and pitches of a frame of w x rows pixels in the output format
+ *  packed at destination.
+ */
+static void frame_planes (uint8_t* destination, int w, int rows, uint8_t* planes[3], int pitches[3])
+{
+    int area = w * rows;
+
+    switch (format)
+    {
+        case JPEG_FORMAT_I422:
+        case JPEG_FORMAT_NV16:
+            pitches[0] = w;
+            pitches[1] = pitches[2] = format == JPEG_FORMAT_I422 ? w >> 1 : w;
+            planes[0]  = destination;
+            planes[1]  = destination + area;
+            planes[2]  = destination + area + (area >> 1);
+            break;
+        default:
+            // packed, 2, 3 or 4 bytes per pixel
+            pitches[0] = pitches[1] = pitches[2] = w * (format == JPEG_FORMAT_RGB24 ? 3 : format == JPEG_FORMAT_RGBA ? 4 : 2);
+            planes[0]  = planes[1] = planes[2] = destination;
+            break;
+    }
+}
+
+/**
+ *  Store the decoded strip of 8 rows, the 2n luma blocks then U then V of
+ *  strip, at output row row of planes in the output format. Planes not used
+ *  by the format may be NULL.
+ */
+static void store_strip (const uint8_t* strip, int n, uint8_t* const planes[3], const int pitches[3], int row)
+{
+    uint8_t* rows[3];
+
+    for (int k = 0; k < 3; k ++)
+        rows[k] = planes[k] != NULL ? planes[k] + row * pitches[k] : NULL;
+    store (strip, strip + CHANNEL_OFFSET (2), strip + CHANNEL_OFFSET (3), n, rows, pitches);
+}
+
+
+/**
+ *  Decode a block and undo the DC prediction.
+ *  Returns the zig zag index of the last nonzero coefficient, or -1 on a
+ *  corrupt block.
+ */
+static inline int decompress_block (uint8_t* data, int* p, int16_t* block, int16_t* dc)
 {
     // decode
-    decode (data, p, block);
+    int last = decode (data, p, block);
+    if (last < 0)
+        return -1;
     block[0] += *dc;
     *dc = block[0];
+    return last;
+}
 
-    // dequantize
-    dequantize (block);
-    block[0] += 1024;
+/**
+ *  Decompress the n blocks of a channel in a strip of 8 rows from bit *p to
+ *  pixels, q the quantization of the channel. blocks must be zeroed and are
+ *  left zeroed. No block starts past bit end, the padding after it covers
+ *  the reads of one.
+ *  Returns non-zero on a corrupt or truncated stream.
+ */
+static int decompress_strip (uint8_t* data, int* p, int end, int16_t* blocks, int n, int16_t* dc,
+                             const struct quantization* q, uint8_t pixels[][JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE])
+{
+    int last[BATCH_SIZE];
+    int x, k, m;
 
-    // inverse DCT
-    ifdct2 (block, decompressed);
+    for (x = 0; x < n; x += m)
+    {
+        // decode a batch of blocks and transform them together
+        m = n - x < BATCH_SIZE ? n - x : BATCH_SIZE;
+        for (k = 0; k < m; k ++)
+        {
+            if (*p > end || (last[k] = decompress_block (data, p, blocks + k * BLOCK_TSIZE, dc)) < 0)
+            {
+                while (k -- > 0)
+                    clear_block (blocks + k * BLOCK_TSIZE, last[k]);
+                return 1;
+            }
+        }
+        reconstruct (blocks, last, m, pixels + x, q);
+        for (k = 0; k < m; k ++)
+            clear_block (blocks + k * BLOCK_TSIZE, last[k]);
+    }
+    return 0;
 }
 
 
-int jpeg_compress (unsigned char* data, unsigned char* destination)
+/**
+ *  Separate the channels of a strip of 8 rows of a UYVY frame into the
+ *  width / 8 blocks of Y and the width / 16 blocks of U and of V.
+ */
+static void deinterleave_blocks (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V)
 {
-    int y, x, i;
+    int y, x;
     int w = width << 1;
-    float coefficients[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE];
-    int16_t dc = 0;
-    int bufferp = JPEG_HEADER_SIZE << 3;
-
-    //                          Prepare data:
-    // separate data from the different channels.
-    // @TODO: it assumes data is packed as UYVY.
-    //        if the data could be captured with separate channels it
-    //        would go a lot faster to skip this crap.
-    // To compute which block we are doing following:
-    // ((y / 8 * width / 8) + (x / 8)) * 64 + (y % 8) * 8 + x % 8
-    i = width >> 3;
-    for (y = 0; y < height; y ++)
-        for (x = 0; x < width; x ++)
-            Y[(((y >> 3) * i + (x >> 3)) << 6) + ((y & 0x7) << 3) + (x & 0x7)] = data[y * w + (x << 1) + 1];
-    i >>= 1;
-    for (y = 0; y < height; y ++)
-        for (x = 0; x < width >> 1; x ++)
+
+    for (y = 0; y < JPEG_BLOCK_SIZE; y ++)
+        for (x = 0; x < width; x += 2)
+        {
+            const uint8_t* pixels = data + y * w + (x << 1);
+            int            i      = ((x >> 3) << 6) + (y << 3) + (x & 0x7);
+            int            j      = ((x >> 4) << 6) + (y << 3) + ((x >> 1) & 0x7);
+            U[j]     = pixels[0];
+            Y[i]     = pixels[1];
+            V[j]     = pixels[2];
+            Y[i + 1] = pixels[3];
+        }
+}
+
+/**
+ *  Convert a strip of 8 rows of packed RGB of bpp bytes per pixel, with red,
+ *  green and blue at bytes r, g and b of a pixel, to the blocks of Y, U and V
+ *  like deinterleave_blocks. The chroma of a pair of pixels is converted from
+ *  the sums of their colors.
+ */
+static inline void convert_rgb_blocks (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V, int bpp, int r, int g, int b)
+{
+    int y, x;
+    int w = width * bpp;
+
+    for (y = 0; y < JPEG_BLOCK_SIZE; y ++)
+        for (x = 0; x < width; x += 2)
         {
-            U[(((y >> 3) * i + (x >> 3)) << 6) + ((y & 0x7) << 3) + (x & 0x7)] = data[y * w + (x << 2)];
-            V[(((y >> 3) * i + (x >> 3)) << 6) + ((y & 0x7) << 3) + (x & 0x7)] = data[y * w + (x << 2) + 2];
+            const uint8_t* p  = data + y * w + x * bpp;
+            const uint8_t* q  = p + bpp;
+            int            i  = ((x >> 3) << 6) + (y << 3) + (x & 0x7);
+            int            j  = ((x >> 4) << 6) + (y << 3) + ((x >> 1) & 0x7);
+            int            rs = p[r] + q[r];
+            int            gs = p[g] + q[g];
+            int            bs = p[b] + q[b];
+            Y[i]     = ((RGB_YUV_YR * p[r] + RGB_YUV_YG * p[g] + RGB_YUV_YB * p[b] + 128) >> 8) + 16;
+            Y[i + 1] = ((RGB_YUV_YR * q[r] + RGB_YUV_YG * q[g] + RGB_YUV_YB * q[b] + 128) >> 8) + 16;
+            U[j]     = ((RGB_YUV_UR * rs + RGB_YUV_UG * gs + RGB_YUV_UB * bs + 256) >> 9) + 128;
+            V[j]     = ((RGB_YUV_VR * rs + RGB_YUV_VG * gs + RGB_YUV_VB * bs + 256) >> 9) + 128;
         }
+}
+
+static void deinterleave_rgb24 (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V)
+{
+    convert_rgb_blocks (data, width, Y, U, V, 3, 0, 1, 2);
+}
+
+static void deinterleave_bgra (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V)
+{
+    convert_rgb_blocks (data, width, Y, U, V, 4, 2, 1, 0);
+}
+
+static void (*deinterleave) (const uint8_t*, int, int16_t*, int16_t*, int16_t*) = deinterleave_blocks;
+
+
+/**
+ *  Most bytes of a frame of w x h with blocks of luma and chroma of at most
+ *  luma_bits and chroma_bits.
+ */
+static size_t frame_bound (int w, int h, int luma_bits, int chroma_bits)
+{
+    size_t blocks = (size_t) (w >> 3) * (h >> 3); // of luma, and of U and V together
+    size_t bits   = blocks * luma_bits + blocks * chroma_bits;
+
+    // the header, and the byte past the end the returned size counts and append_bits may touch
+    return JPEG_HEADER_SIZE + ((bits + 7) >> 3) + 2;
+}
 
-    w  = width >> 1;
+size_t jpeg_compress_bound (int w, int h, int quality)
+{
+    uint16_t luma[BLOCK_TSIZE], chroma[BLOCK_TSIZE];
+
+    quantization_table (quality, QUANTIZATION_LUMA,   luma);
+    quantization_table (quality, QUANTIZATION_CHROMA, chroma);
+    return frame_bound (w, h, block_bound (luma), block_bound (chroma));
+}
+
+
+/**
+ *  Give up on a frame not fitting, leaving the other streams zeroed.
+ */
+static int compress_overflow (uint8_t* stream[4], const int bits[4])
+{
+    for (int c = 1; c < 4; c ++)
+        memset (stream[c], 0, (bits[c] + 7) >> 3);
+    return 0;
+}
+
+int jpeg_compress_bounded (unsigned char* data, unsigned char* destination, size_t capacity)
+{
+    const struct quantization* luma   = &quantization[QUANTIZATION_LUMA];
+    const struct quantization* chroma = &quantization[QUANTIZATION_CHROMA];
+    int      n        = width >> 4; // blocks per strip of a luma half and of a chroma channel
+    int      w        = width * (input_format == JPEG_FORMAT_RGB24 ? 3 : input_format == JPEG_FORMAT_BGRA ? 4 : 2);
+    int16_t  dc[4]    = { 0 };
+    int      bits[4]  = { JPEG_HEADER_SIZE << 3, 0, 0, 0 };
+    uint8_t* stream[4] = { destination, channel_streams[0], channel_streams[1], channel_streams[2] };
+    size_t   room     = capacity > 2 ? (capacity - 2) << 3 : 0; // bits, as jpeg_compress_bound counts
+    int      p;
+
+    // a strip of 8 rows at a time straight from the frame to the entropy coder,
+    // every channel to its own stream: left and right half of luma, U and V
+    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
+    {
+        // the first stream is the destination, it needs room for the longest strip
+        // and the frame so far needs to fit, so no bit written has to be checked
+        if ((size_t) bits[0] + n * luma->block_bits > room ||
+            (size_t) bits[0] + bits[1] + bits[2] + bits[3] > room)
+            return compress_overflow (stream, bits);
+        deinterleave (data + y * w, width, Y, U, V);
+        compress_blocks (Y,                   n, luma,   &dc[0], stream[0], &bits[0]);
+        compress_blocks (Y + n * BLOCK_TSIZE, n, luma,   &dc[1], stream[1], &bits[1]);
+        compress_blocks (U,                   n, chroma, &dc[2], stream[2], &bits[2]);
+        compress_blocks (V,                   n, chroma, &dc[3], stream[3], &bits[3]);
+    }
 
-    //                          Compress color channels:
-    // compress luminance
-    for (i = 0; i < width * height; i += BLOCK_TSIZE)
-        compress_block (Y + i, &dc, coefficients, destination, &bufferp);
-    // store size in bits of luminance data
-    memcpy (destination, &bufferp, sizeof (int));
+    if ((size_t) bits[0] + bits[1] + bits[2] + bits[3] > room)
+        return compress_overflow (stream, bits);
 
-    dc = 0;
-    for ( ; i < width * height; i += BLOCK_TSIZE)
-        compress_block (Y + i, &dc, coefficients, destination, &bufferp);
-    // store size in bits of luminance data
-    memcpy (destination + sizeof (int), &bufferp, sizeof (int));
+    // put the other channels after the first one, the header holds where each one ends
+    p = bits[0];
+    memcpy (destination, &p, sizeof (int));
+    for (int c = 1; c < 4; c ++)
+    {
+        append_bits (stream[c], bits[c], destination, &p);
+        memset (stream[c], 0, (bits[c] + 7) >> 3);
+        memcpy (destination + c * sizeof (int), &p, sizeof (int));
+    }
 
-    // compress chroma blue
-    dc = 0;
-    for (i = 0; i < w * height; i += BLOCK_TSIZE)
-        compress_block (U + i, &dc, coefficients, destination, &bufferp);
-    // store size of blue data
-    memcpy (destination + 2 * sizeof (int), &bufferp, sizeof (int));
+    return (p >> 3) + 1;
+}
 
-    // compress chroma red
-    dc = 0;
-    for (i = 0; i < w * height; i += BLOCK_TSIZE)
-        compress_block (V + i, &dc, coefficients, destination, &bufferp);
-    // store size of red data
-    memcpy (destination + 3 * sizeof (int), &bufferp, sizeof (int));
 
-    return (bufferp << 3) + 1;
+int jpeg_compress (unsigned char* data, unsigned char* destination)
+{
+    return jpeg_compress_bounded (data, destination, frame_bound (width, height,
+                                                                  quantization[QUANTIZATION_LUMA].block_bits,
+                                                                  quantization[QUANTIZATION_CHROMA].block_bits));
 }
 
 
 void jpeg_deinit ()
 {
+#ifdef MULTITHREAD
+    // stop the workers while the pools are still valid, then free what they use
+    for (int i = 0; i < NTHREADS; i ++)
+        thread_pool_push (&jobs, NULL, NULL, 0, 0, 0);
+    for (int i = 0; i < NTHREADS; i ++)
+        pthread_join (threads[i], NULL);
+    thread_pool_destroy (&jobs);
+    thread_pool_destroy (&finished_jobs);
+    free (strips_done);
+#endif
+
     // free temporary buffers
     free (Y);
     free (U);
     free (V);
-    free (buffer);
+    for (int c = 0; c < 3; c ++)
+        hugepages_free (channel_streams[c], stream_bytes);
+    hugepages_free (buffer, width * height * 2);
+#ifdef MULTITHREAD
+    hugepages_free (pixels, (height >> 3) * (width << 4));
+#else
+    free (pixels);
+#endif
+    free (strip_buffer);
     // free huffman trees
     destroy_huffman_tree (huffman_ac_tree);
     destroy_huffman_tree (huffman_dc_tree);
-
-#ifdef MULTITHREAD
-    running = 0;
-    thread_pool_destroy (&jobs);
-    thread_pool_destroy (&finished_jobs);
-#endif
+    free (scratch);
+    initialised = 0;
 }
 
 
 int jpeg_decompress_to_texture (uint8_t* data, size_t size, GLuint tex)
 {
-    jpeg_decompress (data, size, buffer);
-    load_texture (buffer, width, height);
+    uint8_t* mapped;
+
+    if (format != JPEG_FORMAT_UYVY)
+        return 1;
+    // straight into the texture buffer when it can be mapped
+    if ((mapped = map_texture (width >> scale_shift, height >> scale_shift)) != NULL)
+    {
+        int ret = jpeg_decompress (data, size, mapped);
+        unmap_texture ();
+        return ret;
+    }
+    if (jpeg_decompress (data, size, buffer) != 0)
+        return 1;
+    load_texture (buffer, width >> scale_shift, height >> scale_shift);
     return 0;
 }
 
 
-#ifdef MULTITHREAD
+/**
+ *  Decode only the DC coefficients of channel c starting at bit p and store
+ *  the pixel of each block as a block of 1 x 1 pixels to the strips of
+ *  buffer, laid out like those of pixels. Returns the bit pointer past the
+ *  channel, or -1 on a corrupt stream or one reaching past bit end.
+ */
+static int decompress_channel_dc (uint8_t* data, int p, int end, int c)
+{
+    const struct quantization* q = CHANNEL_QUANTIZATION (c);
+    int16_t  dc = 0;
+    int      n  = width >> 4;
+    int      x, y, value;
+    uint8_t  symbol;
+    uint16_t amplitude;
+
+    for (y = 0; y < (height >> 3); y ++)
+    {
+        uint8_t* blocks = buffer + y * (width << 4) + CHANNEL_OFFSET (c);
+        for (x = 0; x < n; x ++)
+        {
+            // DC difference, as in decode
+            if (p > end || (symbol = DECODE_HUFFMAN_DC (data, &p)) == HUFFMAN_INVALID)
+                return -1;
+            amplitude = read_value (data, &p, symbol);
+            if ((amplitude & (1 << (symbol - 1))) == 0)
+                amplitude = ~((~amplitude) & ~(0xFFFF << symbol)) + 1;
+            dc += amplitude;
+            if (skip_ac (huffman_ac_skip, data, &p) != 0)
+                return -1;
+            // the average of the block
+            value = (int) floorf (dc * q->scaled[0][0] + 128.5f);
+            blocks[x << 6] = clamp_byte (value);
+        }
+    }
+    return p;
+}
+
 
-static void* decompress_thread (void* __not_used__)
+int jpeg_decode_dc_only (uint8_t* data, size_t size, uint8_t* destination)
 {
-    int p = 0;
-    int x, y, i, j;
-    int w = width << 1;
-    int16_t dc;
+    int      p[4], end;
+    int      n = width >> 4;
+    uint8_t* planes[3];
+    uint8_t* rows[3];
+    int      pitches[3];
 
-    float tmp[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE];
+    if (read_header (data, size, p, &end) != 0)
+        return 1;
+    // the channels follow each other, every one is decoded before storing
+    for (int c = 0; c < 4; c ++)
+        if ((p[0] = decompress_channel_dc (data, p[0], end, c)) < 0)
+            return 1;
+    // in the output format like the strips of a full decode
+    frame_planes (destination, width >> 3, height >> 3, planes, pitches);
+    for (int y = 0; y < (height >> 3); y ++)
+    {
+        uint8_t* strip = buffer + y * (width << 4);
+        for (int k = 0; k < 3; k ++)
+            rows[k] = planes[k] + y * pitches[k];
+        stores[format] (1, strip, strip + CHANNEL_OFFSET (2), strip + CHANNEL_OFFSET (3), n, rows, pitches);
+    }
+    return 0;
+}
 
-    int offset;
-    uint8_t step;
 
-    int16_t* block;
-    uint8_t* data = NULL;
-    uint8_t* destination = NULL;
+/**
+ *  Decompress data a strip of 8 rows at a time, decoding every channel from
+ *  where it starts in the header and storing the strip once all of them are
+ *  decoded. The strips are stored to planes, or without a callback to
+ *  strip_buffer and passed on to callback.
+ *  Returns non-zero on error.
+ */
+static int decompress_strips (unsigned char* data, size_t size, unsigned char* const planes[3], const int pitches[3],
+                              jpeg_strip_callback callback, void* user)
+{
+    int16_t* block = scratch[NSCRATCH - 1].blocks;
+    int16_t  dc[4] = { 0 };
+    int      p[4];
+    int      end;
+    int      n     = width >> 4;
+    int      lines = JPEG_BLOCK_SIZE >> scale_shift;
+    uint8_t* strip[3];
+    int      strip_pitches[3];
+
+    // every channel starts where the previous one ends
+    if (read_header (data, size, p, &end) != 0)
+        return 1;
+    frame_planes (strip_buffer, width >> scale_shift, lines, strip, strip_pitches);
 
+    // decode a strip of every channel and store them together
+    for (int y = 0; y < height; y += JPEG_BLOCK_SIZE)
+    {
+        for (int c = 0; c < 4; c ++)
+            if (decompress_strip (data, &p[c], end, block, n, &dc[c], CHANNEL_QUANTIZATION (c),
+                                  (uint8_t (*)[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE]) (pixels + CHANNEL_OFFSET (c))) != 0)
+                return 1;
+        if (callback == NULL)
+            store_strip (pixels, n, planes, pitches, y >> scale_shift);
+        else
+        {
+            store_strip (pixels, n, strip, strip_pitches, 0);
+            callback (strip_buffer, y >> scale_shift, lines, user);
+        }
+    }
+
+    return 0;
+}
+
+
+int jpeg_decompress_strips (unsigned char* data, size_t size, jpeg_strip_callback callback, void* user)
+{
+    // without one decompress_strips would store to the planes, there are none
+    if (callback == NULL)
+        return 1;
+    return decompress_strips (data, size, NULL, NULL, callback, user);
+}
+
+
+#ifdef MULTITHREAD
+
+/**
+ *  Decompress channel c starting at bit p strip by strip to pixels. Whichever
+ *  thread decodes the last channel of a strip stores the whole strip to the
+ *  output planes, so every byte of the frame is written once by one thread.
+ *  Returns non-zero on a corrupt stream, the strips from there on are not stored.
+ */
+static int decompress_channel (uint8_t* data, int p, int16_t* blocks, int c)
+{
+    int     n  = width >> 4;
+    int16_t dc = 0;
+
+    for (int y = 0; y < (height >> 3); y ++)
+    {
+        uint8_t* strip = pixels + y * (width << 4);
+        if (decompress_strip (data, &p, stream_end, blocks, n, &dc, CHANNEL_QUANTIZATION (c),
+                              (uint8_t (*)[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE]) (strip + CHANNEL_OFFSET (c))) != 0)
+            return 1;
+        if (__atomic_add_fetch (&strips_done[y], 1, __ATOMIC_ACQ_REL) == 4)
+            store_strip (strip, n, output_planes, output_pitches, (y << 3) >> scale_shift);
+    }
+    return 0;
+}
+
+static void* decompress_thread (void* index)
+{
+    int      i     = (intptr_t) index;
+    int16_t* block = scratch[i].blocks;
+    int      strip = width << 4; // bytes of a strip of pixels, and of 8 rows of the frame buffer
     thread_args args;
 
-    if (posix_memalign ((void**) &block, MEMALIGN, block_byte_size) != 0)
+    // a core of its own when pinned, otherwise any CPU of the node
+    if (ncpus > 0 && pin_threads)
+        affinity_pin (pthread_self (), cpus[i % ncpus]);
+    else if (ncpus > 0)
+        affinity_bind (pthread_self (), cpus, ncpus);
+
+    // Any worker decodes any channel and stores the strips it completes, so
+    // the workers together write all of pixels and the frame buffer. Each one
+    // first touches every NTHREADS-th strip of both, which puts the pages on
+    // the node the workers run on rather than that of the thread in jpeg_init.
+    for (int y = i; y < (height >> 3); y += NTHREADS)
     {
-        fprintf (stderr, "error allocating memory\n");
-        return NULL;
+        memset (pixels + y * strip, 0, strip);
+        memset (buffer + y * strip, 0, strip);
     }
+    thread_pool_push (&finished_jobs, NULL, NULL, 0, 0, 0);
 
-    while (running)
+    for (;;)
     {
-        // pop new job
+        // pop new job, one without data stops the worker
         if (thread_pool_pop (&jobs, &args) == THREAD_POOL_EMPTY)
             continue;
+        if (args.source == NULL)
+            break;
 
-        data        = args.source;
-        destination = args.destination;
-        step        = args.step;
-        offset      = args.offset;
-        p           = args.bitp;
-        dc          = 0;
-
-        for (y = 0; y < height; y += JPEG_BLOCK_SIZE)
-        {
-            for (x = 0; x < (width >> 1); x += JPEG_BLOCK_SIZE)
-            {
-                memset (block, 0, block_byte_size);
-                decompress_block (data, &p, block, &dc, tmp);
-                // copy it to buffer
-                for (i = 0; i < JPEG_BLOCK_SIZE; i ++)
-                    for (j = 0; j < JPEG_BLOCK_SIZE; j ++)
-                        destination[(y + i) * w + ((x + j) << step) + offset] = ROUND_TO_BYTE (tmp[i][j]);
-            }
-        }
-        // push to finished jobs
-        thread_pool_push (&finished_jobs, data, destination, offset, step, args.bitp);
+        // push to finished jobs, a negative bit pointer on a corrupt channel
+        if (decompress_channel (args.source, args.bitp, block, args.offset) != 0)
+            args.bitp = -1;
+        thread_pool_push (&finished_jobs, args.source, args.destination, args.offset, args.step, args.bitp);
     }
 
-    free (block);
     return NULL;
 }
 
 
-int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destination)
+int jpeg_decompress_planes (unsigned char* data, size_t size, unsigned char* const planes[3], const int pitches[3])
 {
-    int bitp = JPEG_HEADER_SIZE << 3;
-    thread_pool_push (&jobs, data, destination, 1, 1, bitp);
+    int p[4];
+    int ret = 0;
 
-    memcpy (&bitp, data, sizeof (int));
-    thread_pool_push (&jobs, data, destination, 1 + width, 1, bitp);
-
-    memcpy (&bitp, data + sizeof (int), sizeof (int));
-    thread_pool_push (&jobs, data, destination, 0, 2, bitp);
-
-    memcpy (&bitp, data + 2 * sizeof (int), sizeof (int));
-    thread_pool_push (&jobs, data, destination, 2, 2, bitp);
+    if (read_header (data, size, p, &stream_end) != 0)
+        return 1;
+    // the offset of a job is the channel it decodes
+    memcpy (output_planes,  planes,  sizeof (output_planes));
+    memcpy (output_pitches, pitches, sizeof (output_pitches));
+    memset (strips_done, 0, (height >> 3) * sizeof (int));
+    for (int c = 0; c < 4; c ++)
+        thread_pool_push (&jobs, data, planes[0], c, 0, p[c]);
 
     thread_args finito;
-    thread_pool_pop (&finished_jobs, &finito);
-    thread_pool_pop (&finished_jobs, &finito);
-    thread_pool_pop (&finished_jobs, &finito);
-    thread_pool_pop (&finished_jobs, &finito);
+    for (int c = 0; c < 4; c ++)
+    {
+        thread_pool_pop (&finished_jobs, &finito);
+        if (finito.bitp < 0)
+            ret = 1;
+    }
 
-    return 0;
+    return ret;
 }
 
 #else /* if not MULTITHREAD : single thread */
 
+int jpeg_decompress_planes (unsigned char* data, size_t size, unsigned char* const planes[3], const int pitches[3])
+{
+    return decompress_strips (data, size, planes, pitches, NULL, NULL);
+}
+
+#endif /* MULTITHREAD */
+
+
 int jpeg_decompress (unsigned char* data, size_t size, unsigned char* destination)
 {
-    int16_t* block;
-    float    tmp[JPEG_BLOCK_SIZE][JPEG_BLOCK_SIZE];
-    int      x, y, i, j;
-    int      p       = JPEG_HEADER_SIZE << 3;
-    int16_t  dc      = 0;
-    int      nblocks = 0;
-    int      w       = width >> 1;
+    uint8_t* planes[3];
+    int      pitches[3];
 
-    if (posix_memalign ((void**) &block, MEMALIGN, block_byte_size) != 0)
-    {
-        fprintf (stderr, "error allocating memory\n");
-        return 1;
-    }
+    frame_planes (destination, width >> scale_shift, height >> scale_shift, planes, pitches);
+    return jpeg_decompress_planes (data, size, planes, pitches);
+}
 
-    // decode luminance
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE)
-    {
-        for (x = 0; x < w; x += JPEG_BLOCK_SIZE, nblocks ++)
-        {
-            memset (block, 0, block_byte_size);
-            decompress_block (data, &p, block, &dc, tmp);
-            // copy it to buffer
-            for (i = 0; i < JPEG_BLOCK_SIZE; i ++)
-                for (j = 0; j < JPEG_BLOCK_SIZE; j ++)
-                    destination[(y + i) * (width << 1) + ((x + j) << 1) + 1] = ROUND_TO_BYTE (tmp[i][j]);
-        }
-    }
 
-    // decode luminance
-    dc = 0;
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE)
+/**
+ *  Build the luma and chroma quantization from the quality and derive the
+ *  tables of the transforms from them.
+ */
+static void quantization_init ()
+{
+    uint16_t table[BLOCK_TSIZE];
+
+    for (int c = QUANTIZATION_LUMA; c <= QUANTIZATION_CHROMA; c ++)
     {
-        for (x = 0; x < w; x += JPEG_BLOCK_SIZE, nblocks ++)
-        {
-            memset (block, 0, block_byte_size);
-            decompress_block (data, &p, block, &dc, tmp);
-            // copy it to buffer
-            for (i = 0; i < JPEG_BLOCK_SIZE; i ++)
-                for (j = 0; j < JPEG_BLOCK_SIZE; j ++)
-                    destination[(y + i) * (width << 1) + ((x + j) << 1) + 1 + width] = ROUND_TO_BYTE (tmp[i][j]);
-        }
+        struct quantization* q = &quantization[c];
+        quantization_table (quality, c, table);
+        for (int i = 0; i < BLOCK_TSIZE; i ++)
+            q->matrix[i >> 3][i & 7] = table[i];
+        ifdct2_scale_table (&q->matrix[0][0], &q->scaled[0][0]);
+        q->scalar     = quantization_divisors (table, q->divisors);
+        q->block_bits = block_bound (table);
+        q->lambda     = trellis_lambda (&q->matrix[0][0]);
     }
+}
 
-    dc = 0;
-    // decode chrominance
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE)
+/**
+ *  Bind the kernels to the fastest versions supported by both the CPU and
+ *  simd_level.
+ */
+static void bind_kernels ()
+{
+    int features = cpu_features ();
+    int sse41    = (features & CPU_SSE41) && simd_level >= JPEG_SIMD_SSE41;
+    int avx2     = (features & CPU_AVX2)  && simd_level >= JPEG_SIMD_AVX2;
+
+    inverse_transform = idct_method == JPEG_IDCT_INT ? idct_int : idct_float;
+    reconstruct       = !avx2 ? reconstruct_blocks :
+                        idct_method == JPEG_IDCT_INT ? reconstruct_blocks_int_avx2 : reconstruct_blocks_avx2;
+    if (scale_shift > 0)
+        reconstruct = reconstruct_blocks_reduced;
+    transform         = avx2  ? transform_blocks_avx2    : transform_blocks;
+    if (rdo)
+        transform = transform_blocks_trellis;
+    switch (input_format)
     {
-        for (x = 0; x < w; x += JPEG_BLOCK_SIZE, nblocks ++)
-        {
-            memset (block, 0, block_byte_size);
-            decompress_block (data, &p, block, &dc, tmp);
-            // copy it to buffer
-            for (i = 0; i < JPEG_BLOCK_SIZE; i ++)
-                for (j = 0; j < JPEG_BLOCK_SIZE; j ++)
-                    destination[(y + i) * (width << 1) + ((x + j) << 2)] = ROUND_TO_BYTE (tmp[i][j]);
-        }
+        case JPEG_FORMAT_RGB24: deinterleave = sse41 ? rgb24_deinterleave_sse41 : deinterleave_rgb24;  break;
+        case JPEG_FORMAT_BGRA:  deinterleave = sse41 ? bgra_deinterleave_sse41  : deinterleave_bgra;   break;
+        default:                deinterleave = sse41 ? uyvy_deinterleave_sse41  : deinterleave_blocks; break;
     }
-
-    dc = 0;
-    for (y = 0; y < height; y += JPEG_BLOCK_SIZE)
+    // the SSE4.1 stores only handle full size blocks
+    sse41 = sse41 && scale_shift == 0;
+    switch (sse41 ? format : -1)
     {
-        for (x = 0; x < w; x += JPEG_BLOCK_SIZE, nblocks ++)
-        {
-            memset (block, 0, block_byte_size);
-            decompress_block (data, &p, block, &dc, tmp);
-            // copy it to buffer
-            for (i = 0; i < JPEG_BLOCK_SIZE; i ++)
-                for (j = 0; j < JPEG_BLOCK_SIZE; j ++)
-                    destination[(y + i) * (width << 1) + ((x + j) << 2) + 2] = ROUND_TO_BYTE (tmp[i][j]);
-        }
+        case JPEG_FORMAT_UYVY:  store = uyvy_store_sse41;  break;
+        case JPEG_FORMAT_I422:  store = i422_store_sse41;  break;
+        case JPEG_FORMAT_NV16:  store = nv16_store_sse41;  break;
+        case JPEG_FORMAT_RGB24: store = rgb24_store_sse41; break;
+        case JPEG_FORMAT_RGBA:  store = rgba_store_sse41;  break;
+        default:                store = store_scaled;      break;
     }
-
-    free (block);
-    return 0;
 }
 
-#endif /* MULTITHREAD */
-
 
 int jpeg_init (int w, int h, GLuint text)
 {
     width  = w;
     height = h;
 
-    if (posix_memalign ((void**) &Y, MEMALIGN, width * height     * sizeof (int16_t)) != 0 ||
-        posix_memalign ((void**) &U, MEMALIGN, width * height / 2 * sizeof (int16_t)) != 0 ||
-        posix_memalign ((void**) &V, MEMALIGN, width * height / 2 * sizeof (int16_t)) != 0)
+    // a strip of blocks, and the streams of every channel but the first zeroed for write_bits.
+    // Buffers of a frame are on huge pages when the system has them.
+    if (posix_memalign ((void**) &Y, MEMALIGN, width * JPEG_BLOCK_SIZE     * sizeof (int16_t)) != 0 ||
+        posix_memalign ((void**) &U, MEMALIGN, width * JPEG_BLOCK_SIZE / 2 * sizeof (int16_t)) != 0 ||
+        posix_memalign ((void**) &V, MEMALIGN, width * JPEG_BLOCK_SIZE / 2 * sizeof (int16_t)) != 0)
     {
         fprintf (stderr, "error allocating init memory\n");
         return 1;
     }
-    memset (Y, 0, width * height     * sizeof (int16_t));
-    memset (U, 0, width * height / 2 * sizeof (int16_t));
-    memset (V, 0, width * height / 2 * sizeof (int16_t));
+    stream_bytes = (size_t) (width >> 4) * (height >> 3) * ((huffman_block_bound (NULL) + 7) >> 3);
+    for (int c = 0; c < 3; c ++)
+        if ((channel_streams[c] = hugepages_alloc (stream_bytes)) == NULL)
+        {
+            fprintf (stderr, "error allocating init memory\n");
+            return 1;
+        }
 
-    buffer = malloc (width * height * 2);
-    memset (buffer, 0, width * height * 2);
+    if ((buffer = hugepages_alloc (width * height * 2)) == NULL)
+    {
+        fprintf (stderr, "error allocating init memory\n");
+        return 1;
+    }
+
+    // the threads decode every strip of a frame before storing it, a single thread one strip.
+    // The channels of a strip start on cache lines so the threads decoding them share none.
+#ifdef MULTITHREAD
+    if ((pixels = hugepages_alloc ((height >> 3) * (width << 4))) == NULL ||
+        (strips_done = calloc (height >> 3, sizeof (int))) == NULL ||
+#else
+    if (posix_memalign ((void**) &pixels, CACHE_LINE, width << 4) != 0 ||
+#endif
+        posix_memalign ((void**) &scratch, CACHE_LINE, NSCRATCH * sizeof (struct scratch)) != 0 ||
+        (strip_buffer = malloc (width * JPEG_BLOCK_SIZE * 4)) == NULL)
+    {
+        fprintf (stderr, "error allocating init memory\n");
+        return 1;
+    }
+    // the decoder keeps the coefficients zeroed from here on
+    memset (scratch, 0, NSCRATCH * sizeof (struct scratch));
 
     huffman_init ();
+    trellis_init ();
+
+    quantization_init ();
+    bind_kernels ();
 
 #ifdef MULTITHREAD
+    // CPUs to place the workers on
+    if (pin_threads || numa_node != AFFINITY_ANY_NODE)
+    {
+        ncpus = affinity_cpus (numa_node, cpus, AFFINITY_MAX_CPUS);
+        if (ncpus == 0)
+            fprintf (stderr, "could not find any CPUs for node %d, threads will not be pinned\n", numa_node);
+    }
     // init thread pools
     thread_pool_init (&jobs);
     thread_pool_init (&finished_jobs);
-    // start decoder threads
-    pthread_create (&thread_1, NULL, decompress_thread, NULL);
-    pthread_create (&thread_2, NULL, decompress_thread, NULL);
-    pthread_create (&thread_3, NULL, decompress_thread, NULL);
-    pthread_create (&thread_4, NULL, decompress_thread, NULL);
+    // start decoder threads and wait for them to have touched the buffers they write
+    thread_args args;
+    for (intptr_t i = 0; i < NTHREADS; i ++)
+        pthread_create (&threads[i], NULL, decompress_thread, (void*) i);
+    for (int i = 0; i < NTHREADS; i ++)
+        while (thread_pool_pop (&finished_jobs, &args) != 0) ;
+#else
+    memset (buffer, 0, width * height * 2);
 #endif
+    initialised = 1;
 
     return 0;
 }
+
+
+/**
+ *  Set an option of the kernels, binding them again if already initialised.
+ *  Returns 0.
+ */
+static int set_kernel_option (int* option, int value)
+{
+    *option = value;
+    if (initialised)
+        bind_kernels ();
+    return 0;
+}
+
+int jpeg_set_option (int option, int value)
+{
+    int shift;
+
+    switch (option)
+    {
+        case JPEG_OPTION_IDCT:
+            if (value != JPEG_IDCT_FLOAT && value != JPEG_IDCT_INT)
+                return 1;
+            // the reduced transforms are only floating point
+            if (value == JPEG_IDCT_INT && scale_shift > 0)
+                return 1;
+            return set_kernel_option (&idct_method, value);
+        case JPEG_OPTION_SCALE:
+            if (value != 1 && value != 2 && value != 4 && value != 8)
+                return 1;
+            if (value > 1 && idct_method == JPEG_IDCT_INT)
+                return 1;
+            for (shift = 0; (1 << shift) < value; shift ++) ;
+            return set_kernel_option (&scale_shift, shift);
+        case JPEG_OPTION_SIMD:
+            if (value < JPEG_SIMD_NONE || value > JPEG_SIMD_BEST)
+                return 1;
+            return set_kernel_option (&simd_level, value);
+        case JPEG_OPTION_QUALITY:
+            if (value < 0 || value > 100)
+                return 1;
+            // takes effect immediately so it can change between frames
+            quality = value;
+            quantization_init ();
+            return 0;
+        case JPEG_OPTION_RDO:
+            return set_kernel_option (&rdo, value != 0);
+        case JPEG_OPTION_FORMAT:
+            if (value < JPEG_FORMAT_UYVY || value > JPEG_FORMAT_RGBA)
+                return 1;
+            return set_kernel_option (&format, value);
+        case JPEG_OPTION_INPUT_FORMAT:
+            if (value != JPEG_FORMAT_UYVY && value != JPEG_FORMAT_RGB24 && value != JPEG_FORMAT_BGRA)
+                return 1;
+            return set_kernel_option (&input_format, value);
+#ifdef MULTITHREAD
+        // the workers are placed when they start in jpeg_init
+        case JPEG_OPTION_PIN_THREADS:
+            if (initialised)
+                return 1;
+            pin_threads = value;
+            return 0;
+        case JPEG_OPTION_NUMA_NODE:
+            if (initialised)
+                return 1;
+            numa_node = value;
+            return 0;
+#endif
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,135 @@
+#include "trellis.h"
+#include "huffman.h"
+#include <float.h>
+#include <math.h>
+
+
+#define BLOCK_TSIZE  64
+#define ZRL          MAX_RUN_LEN // run length code of the encoder skipping MAX_RUN_LEN zeroes
+#define LAMBDA_SCALE 0.03f       // of the geometric mean of the squared steps, tuned for PSNR
+
+
+/* raster index of the coefficients in zig zag order */
+static const uint8_t zigzag[BLOCK_TSIZE] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static uint8_t code_length[MAX_RUN_LEN + 1][MAX_SIZE + 1];
+
+
+void trellis_init ()
+{
+    for (int run = 0; run <= MAX_RUN_LEN; run ++)
+        for (int size = 0; size <= MAX_SIZE; size ++)
+            code_length[run][size] = huffman_ac_code_length (run, size);
+}
+
+
+float trellis_lambda (const float* q)
+{
+    float sum = 0;
+    for (int i = 1; i < BLOCK_TSIZE; i ++)
+        sum += logf (q[i] * q[i]);
+    return LAMBDA_SCALE * expf (sum / (BLOCK_TSIZE - 1));
+}
+
+
+/**
+ *  Bits of a nonzero amplitude of size bits after run zeroes, as encode writes it.
+ */
+static inline int run_length_bits (int run, int size)
+{
+    int bits = 0;
+    for ( ; run > MAX_RUN_LEN; run -= ZRL)
+        bits += code_length[MAX_RUN_LEN][0];
+    return bits + code_length[run][size];
+}
+
+static inline int amplitude_size (int value)
+{
+    int size = 0;
+    for ( ; value != 0; value >>= 1)
+        size ++;
+    return size;
+}
+
+
+void trellis_quantize (int16_t* block, const float* q, float lambda)
+{
+    float   magnitude[BLOCK_TSIZE];
+    float   zeroed[BLOCK_TSIZE];   // error of zeroing zig zag positions 1 to i
+    float   cost[BLOCK_TSIZE];     // lowest cost of positions 1 to i with i the last nonzero
+    int16_t value[BLOCK_TSIZE];
+    int8_t  previous[BLOCK_TSIZE]; // nonzero position before i on the best path
+    int     i, j, k, v, rounded, last;
+    float   error, c, best;
+
+    block[0] = lrintf (block[0] / q[0]);
+
+    cost[0]   = 0;
+    zeroed[0] = 0;
+    for (i = 1; i < BLOCK_TSIZE; i ++)
+    {
+        k            = zigzag[i];
+        magnitude[i] = block[k] < 0 ? -block[k] : block[k];
+        zeroed[i]    = zeroed[i - 1] + magnitude[i] * magnitude[i];
+    }
+
+    // best path ending with a nonzero value at i, for the rounded value and one step less
+    for (i = 1; i < BLOCK_TSIZE; i ++)
+    {
+        k        = zigzag[i];
+        cost[i]  = FLT_MAX;
+        rounded  = (int) (magnitude[i] / q[k] + 0.5f);
+        rounded  = rounded > (1 << MAX_SIZE) - 1 ? (1 << MAX_SIZE) - 1 : rounded;
+        for (v = rounded; v >= 1 && v >= rounded - 1; v --)
+        {
+            error = (magnitude[i] - v * q[k]) * (magnitude[i] - v * q[k]);
+            for (j = i - 1; j >= 0; j --)
+            {
+                // zeroes in between only add error going back
+                c = zeroed[i - 1] - zeroed[j] + error;
+                if (c >= cost[i])
+                    break;
+                if (cost[j] == FLT_MAX)
+                    continue;
+                c += cost[j] + lambda * run_length_bits (i - j - 1, amplitude_size (v));
+                if (c < cost[i])
+                {
+                    cost[i]     = c;
+                    value[i]    = v;
+                    previous[i] = j;
+                }
+            }
+        }
+    }
+
+    // zeroes after the last nonzero value, the end of block code is always written
+    last = 0;
+    best = zeroed[BLOCK_TSIZE - 1];
+    for (i = 1; i < BLOCK_TSIZE; i ++)
+    {
+        c = cost[i] + zeroed[BLOCK_TSIZE - 1] - zeroed[i];
+        if (c < best)
+        {
+            best = c;
+            last = i;
+        }
+    }
+
+    for (i = BLOCK_TSIZE - 1; i > 0; i --)
+    {
+        k = zigzag[i];
+        if (i != last)
+            block[k] = 0;
+        else
+        {
+            block[k] = block[k] < 0 ? -value[i] : value[i];
+            last     = previous[i];
+        }
+    }
+}
@@ -0,0 +1,307 @@
+#include "uyvy.h"
+#include <smmintrin.h>
+
+
+#define BLOCK_SIZE  8
+#define PAIRS(a, b) _mm_setr_epi16 ((a), (b), (a), (b), (a), (b), (a), (b)) // madd_epi16 factors
+
+
+void uyvy_deinterleave_sse41 (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V)
+{
+    // gather the 8 Y of 16 bytes, and the 4 U then 4 V of 16 bytes
+    const __m128i luma   = _mm_setr_epi8 (1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i chroma = _mm_setr_epi8 (0, 4, 8, 12, 2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    int w = width << 1;
+    int x, y;
+
+    for (y = 0; y < BLOCK_SIZE; y ++)
+    {
+        const uint8_t* row  = data + y * w;
+        int16_t*       yrow = Y + (y << 3);
+        int16_t*       urow = U + (y << 3);
+        int16_t*       vrow = V + (y << 3);
+
+        // 16 pixels, a row of two luma blocks and of one block of each chroma
+        for (x = 0; x < width; x += 2 * BLOCK_SIZE, yrow += 128, urow += 64, vrow += 64)
+        {
+            __m128i a  = _mm_loadu_si128 ((const __m128i*) (row + (x << 1)));
+            __m128i b  = _mm_loadu_si128 ((const __m128i*) (row + (x << 1) + 16));
+            __m128i uv = _mm_unpacklo_epi32 (_mm_shuffle_epi8 (a, chroma), _mm_shuffle_epi8 (b, chroma));
+            _mm_storeu_si128 ((__m128i*) yrow,        _mm_cvtepu8_epi16 (_mm_shuffle_epi8 (a, luma)));
+            _mm_storeu_si128 ((__m128i*) (yrow + 64), _mm_cvtepu8_epi16 (_mm_shuffle_epi8 (b, luma)));
+            _mm_storeu_si128 ((__m128i*) urow,        _mm_cvtepu8_epi16 (uv));
+            _mm_storeu_si128 ((__m128i*) vrow,        _mm_cvtepu8_epi16 (_mm_srli_si128 (uv, 8)));
+        }
+    }
+}
+
+
+
+/**
+ *  Byte shuffles of 4 pixels starting at byte base of 16 loaded bytes, bpp
+ *  bytes per pixel with red, green and blue at bytes r, g and b: to the
+ *  (R, G) 16-bit pairs of each pixel, and to (B, 0) which gets a 1 or-ed in.
+ */
+static void rgb_shuffles (int base, int bpp, int r, int g, int b, __m128i* rg, __m128i* b0)
+{
+    int8_t m[2][16];
+
+    for (int p = 0; p < 4; p ++)
+    {
+        int k = base + p * bpp;
+        m[0][4 * p]     = k + r;
+        m[0][4 * p + 1] = -1;
+        m[0][4 * p + 2] = k + g;
+        m[0][4 * p + 3] = -1;
+        m[1][4 * p]     = k + b;
+        m[1][4 * p + 1] = m[1][4 * p + 2] = m[1][4 * p + 3] = -1;
+    }
+    *rg = _mm_loadu_si128 ((const __m128i*) m[0]);
+    *b0 = _mm_loadu_si128 ((const __m128i*) m[1]);
+}
+
+/**
+ *  Convert a strip of packed RGB with 16 pixels in bpp * 16 bytes, read as
+ *  four loads of 16 bytes at offsets each holding 4 pixels.
+ */
+static inline void rgb_deinterleave (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V,
+                                     int bpp, int r, int g, int b, const int offsets[4])
+{
+    const __m128i one     = _mm_set1_epi32 (1 << 16);
+    const __m128i luma_rg = PAIRS (RGB_YUV_YR, RGB_YUV_YG);
+    const __m128i luma_b  = PAIRS (RGB_YUV_YB, 128);
+    const __m128i u_rg    = PAIRS (RGB_YUV_UR, RGB_YUV_UG);
+    const __m128i u_b     = PAIRS (RGB_YUV_UB, 128);
+    const __m128i v_rg    = PAIRS (RGB_YUV_VR, RGB_YUV_VG);
+    const __m128i v_b     = PAIRS (RGB_YUV_VB, 128);
+    const __m128i y16     = _mm_set1_epi16 (16);
+    const __m128i c128    = _mm_set1_epi16 (128);
+    __m128i rg_mask[4], b_mask[4], rg[4], b1[4], y[4], u[2], v[2], s, t;
+    int     w = width * bpp;
+    int     x, i, k;
+
+    for (k = 0; k < 4; k ++)
+        rgb_shuffles (4 * k * bpp - offsets[k], bpp, r, g, b, &rg_mask[k], &b_mask[k]);
+
+    for (i = 0; i < BLOCK_SIZE; i ++)
+    {
+        const uint8_t* row  = data + i * w;
+        int16_t*       yrow = Y + (i << 3);
+        int16_t*       urow = U + (i << 3);
+        int16_t*       vrow = V + (i << 3);
+
+        // 16 pixels, a row of two luma blocks and of one block of each chroma
+        for (x = 0; x < width; x += 2 * BLOCK_SIZE, row += 16 * bpp, yrow += 128, urow += 64, vrow += 64)
+        {
+            for (k = 0; k < 4; k ++)
+            {
+                __m128i a = _mm_loadu_si128 ((const __m128i*) (row + offsets[k]));
+                rg[k] = _mm_shuffle_epi8 (a, rg_mask[k]);
+                b1[k] = _mm_or_si128 (_mm_shuffle_epi8 (a, b_mask[k]), one);
+                y[k]  = _mm_srai_epi32 (_mm_add_epi32 (_mm_madd_epi16 (rg[k], luma_rg), _mm_madd_epi16 (b1[k], luma_b)), 8);
+            }
+            for (k = 0; k < 2; k ++)
+            {
+                // sums of the pairs of pixels, R + R and G + G stay in their 16 bits
+                s    = _mm_hadd_epi32 (rg[2 * k], rg[2 * k + 1]);
+                t    = _mm_hadd_epi32 (b1[2 * k], b1[2 * k + 1]);
+                u[k] = _mm_srai_epi32 (_mm_add_epi32 (_mm_madd_epi16 (s, u_rg), _mm_madd_epi16 (t, u_b)), 9);
+                v[k] = _mm_srai_epi32 (_mm_add_epi32 (_mm_madd_epi16 (s, v_rg), _mm_madd_epi16 (t, v_b)), 9);
+            }
+            _mm_storeu_si128 ((__m128i*) yrow,        _mm_add_epi16 (_mm_packs_epi32 (y[0], y[1]), y16));
+            _mm_storeu_si128 ((__m128i*) (yrow + 64), _mm_add_epi16 (_mm_packs_epi32 (y[2], y[3]), y16));
+            _mm_storeu_si128 ((__m128i*) urow,        _mm_add_epi16 (_mm_packs_epi32 (u[0], u[1]), c128));
+            _mm_storeu_si128 ((__m128i*) vrow,        _mm_add_epi16 (_mm_packs_epi32 (v[0], v[1]), c128));
+        }
+    }
+}
+
+void rgb24_deinterleave_sse41 (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V)
+{
+    // the last 4 pixels are loaded from 4 bytes earlier to not read past the 48 bytes
+    const int offsets[4] = { 0, 12, 24, 32 };
+    rgb_deinterleave (data, width, Y, U, V, 3, 0, 1, 2, offsets);
+}
+
+void bgra_deinterleave_sse41 (const uint8_t* data, int width, int16_t* Y, int16_t* U, int16_t* V)
+{
+    const int offsets[4] = { 0, 16, 32, 48 };
+    rgb_deinterleave (data, width, Y, U, V, 4, 2, 1, 0, offsets);
+}
+
+/**
+ *  Load row i of the two luma blocks at Y as 16 bytes, and the rows of the
+ *  chroma blocks at U and V as the low 8 bytes of u and v.
+ */
+static inline __m128i load_rows (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int i, __m128i* u, __m128i* v)
+{
+    *u = _mm_loadl_epi64 ((const __m128i*) (U + (i << 3)));
+    *v = _mm_loadl_epi64 ((const __m128i*) (V + (i << 3)));
+    return _mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i*) (Y + (i << 3))),
+                               _mm_loadl_epi64 ((const __m128i*) (Y + 64 + (i << 3))));
+}
+
+void uyvy_store_sse41 (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    __m128i  y, u, v, uv;
+    uint8_t* row;
+    int      k, i;
+
+    for (k = 0; k < n; k ++, Y += 128, U += 64, V += 64)
+        for (i = 0; i < BLOCK_SIZE; i ++)
+        {
+            // a row of the two luma blocks, and U and V interleaved as in the frame
+            y   = load_rows (Y, U, V, i, &u, &v);
+            uv  = _mm_unpacklo_epi8 (u, v);
+            row = planes[0] + i * strides[0] + (k << 5);
+            _mm_storeu_si128 ((__m128i*) row,        _mm_unpacklo_epi8 (uv, y));
+            _mm_storeu_si128 ((__m128i*) (row + 16), _mm_unpackhi_epi8 (uv, y));
+        }
+}
+
+void i422_store_sse41 (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    __m128i u, v;
+    int     k, i;
+
+    for (k = 0; k < n; k ++, Y += 128, U += 64, V += 64)
+        for (i = 0; i < BLOCK_SIZE; i ++)
+        {
+            _mm_storeu_si128 ((__m128i*) (planes[0] + i * strides[0] + (k << 4)), load_rows (Y, U, V, i, &u, &v));
+            _mm_storel_epi64 ((__m128i*) (planes[1] + i * strides[1] + (k << 3)), u);
+            _mm_storel_epi64 ((__m128i*) (planes[2] + i * strides[2] + (k << 3)), v);
+        }
+}
+
+void nv16_store_sse41 (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    __m128i u, v;
+    int     k, i;
+
+    for (k = 0; k < n; k ++, Y += 128, U += 64, V += 64)
+        for (i = 0; i < BLOCK_SIZE; i ++)
+        {
+            _mm_storeu_si128 ((__m128i*) (planes[0] + i * strides[0] + (k << 4)), load_rows (Y, U, V, i, &u, &v));
+            _mm_storeu_si128 ((__m128i*) (planes[1] + i * strides[1] + (k << 4)), _mm_unpacklo_epi8 (u, v));
+        }
+}
+
+
+/**
+ *  Convert 4 pixels, (luma - 16, U - 128) and (luma - 16, V - 128) pairs of
+ *  16-bit values, to 32-bit R, G and B before the shift by 8.
+ */
+static inline void convert4 (__m128i yu, __m128i yv, __m128i v1, __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i red   = PAIRS (YUV_RGB_Y,  YUV_RGB_RV);
+    const __m128i green = PAIRS (YUV_RGB_Y,  YUV_RGB_GU);
+    const __m128i gv    = PAIRS (YUV_RGB_GV, 1);
+    const __m128i blue  = PAIRS (YUV_RGB_Y,  YUV_RGB_BU);
+    const __m128i round = _mm_set1_epi32 (128);
+
+    *r = _mm_add_epi32 (_mm_madd_epi16 (yv, red), round);
+    *g = _mm_add_epi32 (_mm_madd_epi16 (yu, green), _mm_madd_epi16 (v1, gv)); // v1 holds (V - 128, 128)
+    *b = _mm_add_epi32 (_mm_madd_epi16 (yu, blue), round);
+}
+
+/**
+ *  Convert row i of the two luma blocks at Y and the chroma blocks at U and V
+ *  to 16 bytes of each of R, G and B.
+ */
+static inline void convert_row (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int i, __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i y16   = _mm_set1_epi16 (16);
+    const __m128i c128  = _mm_set1_epi16 (128);
+    __m128i u, v, y, c[2], d[2], e[2], rc[4], gc[4], bc[4];
+
+    y    = load_rows (Y, U, V, i, &u, &v);
+    c[0] = _mm_sub_epi16 (_mm_cvtepu8_epi16 (y), y16);
+    c[1] = _mm_sub_epi16 (_mm_cvtepu8_epi16 (_mm_srli_si128 (y, 8)), y16);
+    // every chroma sample for two pixels
+    u    = _mm_sub_epi16 (_mm_cvtepu8_epi16 (u), c128);
+    v    = _mm_sub_epi16 (_mm_cvtepu8_epi16 (v), c128);
+    d[0] = _mm_unpacklo_epi16 (u, u);
+    d[1] = _mm_unpackhi_epi16 (u, u);
+    e[0] = _mm_unpacklo_epi16 (v, v);
+    e[1] = _mm_unpackhi_epi16 (v, v);
+
+    for (int h = 0; h < 2; h ++)
+    {
+        convert4 (_mm_unpacklo_epi16 (c[h], d[h]), _mm_unpacklo_epi16 (c[h], e[h]), _mm_unpacklo_epi16 (e[h], c128),
+                  &rc[2 * h], &gc[2 * h], &bc[2 * h]);
+        convert4 (_mm_unpackhi_epi16 (c[h], d[h]), _mm_unpackhi_epi16 (c[h], e[h]), _mm_unpackhi_epi16 (e[h], c128),
+                  &rc[2 * h + 1], &gc[2 * h + 1], &bc[2 * h + 1]);
+    }
+
+    // shift, then saturate to bytes
+    for (int j = 0; j < 4; j ++)
+    {
+        rc[j] = _mm_srai_epi32 (rc[j], 8);
+        gc[j] = _mm_srai_epi32 (gc[j], 8);
+        bc[j] = _mm_srai_epi32 (bc[j], 8);
+    }
+    *r = _mm_packus_epi16 (_mm_packs_epi32 (rc[0], rc[1]), _mm_packs_epi32 (rc[2], rc[3]));
+    *g = _mm_packus_epi16 (_mm_packs_epi32 (gc[0], gc[1]), _mm_packs_epi32 (gc[2], gc[3]));
+    *b = _mm_packus_epi16 (_mm_packs_epi32 (bc[0], bc[1]), _mm_packs_epi32 (bc[2], bc[3]));
+}
+
+void rgb24_store_sse41 (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    // where the bytes of R, G and B go in each 16 bytes of 16 RGB pixels
+    const __m128i shuffle[3][3] =
+    {
+        {
+            _mm_setr_epi8 ( 0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5),
+            _mm_setr_epi8 (-1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1),
+            _mm_setr_epi8 (-1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1)
+        },
+        {
+            _mm_setr_epi8 (-1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1),
+            _mm_setr_epi8 ( 5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10),
+            _mm_setr_epi8 (-1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1)
+        },
+        {
+            _mm_setr_epi8 (-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1),
+            _mm_setr_epi8 (-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1),
+            _mm_setr_epi8 (10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)
+        }
+    };
+    __m128i  r, g, b;
+    uint8_t* row;
+    int      k, i, j;
+
+    for (k = 0; k < n; k ++, Y += 128, U += 64, V += 64)
+        for (i = 0; i < BLOCK_SIZE; i ++)
+        {
+            convert_row (Y, U, V, i, &r, &g, &b);
+            row = planes[0] + i * strides[0] + k * 48;
+            for (j = 0; j < 3; j ++)
+                _mm_storeu_si128 ((__m128i*) (row + (j << 4)),
+                                  _mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (r, shuffle[j][0]),
+                                                              _mm_shuffle_epi8 (g, shuffle[j][1])),
+                                                _mm_shuffle_epi8 (b, shuffle[j][2])));
+        }
+}
+
+void rgba_store_sse41 (const uint8_t* Y, const uint8_t* U, const uint8_t* V, int n, uint8_t* const planes[3], const int strides[3])
+{
+    const __m128i alpha = _mm_set1_epi8 (-1);
+    __m128i  r, g, b, rg, ba;
+    uint8_t* row;
+    int      k, i;
+
+    for (k = 0; k < n; k ++, Y += 128, U += 64, V += 64)
+        for (i = 0; i < BLOCK_SIZE; i ++)
+        {
+            convert_row (Y, U, V, i, &r, &g, &b);
+            row = planes[0] + i * strides[0] + (k << 6);
+            rg  = _mm_unpacklo_epi8 (r, g);
+            ba  = _mm_unpacklo_epi8 (b, alpha);
+            _mm_storeu_si128 ((__m128i*) row,        _mm_unpacklo_epi16 (rg, ba));
+            _mm_storeu_si128 ((__m128i*) (row + 16), _mm_unpackhi_epi16 (rg, ba));
+            rg  = _mm_unpackhi_epi8 (r, g);
+            ba  = _mm_unpackhi_epi8 (b, alpha);
+            _mm_storeu_si128 ((__m128i*) (row + 32), _mm_unpacklo_epi16 (rg, ba));
+            _mm_storeu_si128 ((__m128i*) (row + 48), _mm_unpackhi_epi16 (rg, ba));
+        }
+}
@@ -1,7 +1,11 @@
 #include "jpeg/jpeg.h"
+#include "hugepages.h"
+#include "mjpg.h"
 #include "ui.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
@@ -12,6 +16,14 @@
 #define MULTIFILES_PATH         "video/multi"
 #define SINGLEFILE_PATH         "video/single"
 #define PIX_FMT                 AV_PIX_FMT_YUV422P
+#define FRAME_SIZE_ARG          "-s"
+#define BITRATE_ARG             "-b"
+
+#define RATE_OVERSHOOT          1.25 // frames this much over the target are encoded again
+#define RATE_MIN_SCALE          1.0  // range of the libjpeg quantization scale, in percent
+#define RATE_MAX_SCALE          5000.0
+#define RATE_MIN_EXPONENT       0.1
+#define RATE_MAX_EXPONENT       2.0
 
 
 static AVFormatContext*     fmt_ctx;
@@ -27,10 +39,62 @@ static uint8_t*             video_dst_data[4] = { NULL };
 static int                  video_dst_linesize[4];
 static int                  destination_buffer_size;
 static uint8_t*             planar_image;
+static uint8_t*             jpeg_buffer;   // compressed frame, grown when a frame does not fit
+static size_t               capacity;      // of jpeg_buffer
 
 static FILE*                fp;
-static FILE*                ifp;
+static FILE*                qfp;           // quality of every frame when rate controlled, multiple files
+static mjpg_writer          video;         // the single file
+static int                  frame_quality; // of the last frame when rate controlled, else 0
+
+/**
+ *  Rate control. Frame sizes are modelled as size = c * scale ^ -exponent,
+ *  scale being the libjpeg scaling of the standard quantization tables.
+ *  Every frame is encoded with the scale predicted from the previous one and
+ *  the exponent is refitted whenever two encodes at different scales are known.
+ */
+static double               target_size   = 0;   // bytes per frame, 0 disables rate control
+static double               bitrate       = 0;   // bits per second, converted to target_size
+static double               rate_scale    = 100; // scale of the next frame, quality 50
+static double               rate_exponent = 0.5;
+
+
+/**
+ *  Quality of libjpeg for a quantization scale in percent, and the inverse.
+ */
+static int scale_to_quality (double scale)
+{
+    int quality = scale < 100 ? lround ((200 - scale) / 2) : lround (5000 / scale);
+    return quality < 1 ? 1 : quality > 100 ? 100 : quality;
+}
+
+static double quality_to_scale (int quality)
+{
+    return quality < 50 ? 5000.0 / quality : 200 - (quality << 1);
+}
+
+/**
+ *  Scale predicted to give target_size from a frame of size bytes encoded at scale.
+ */
+static double predict_scale (double scale, int size)
+{
+    scale *= pow (size / target_size, 1 / rate_exponent);
+    return scale < RATE_MIN_SCALE ? RATE_MIN_SCALE : scale > RATE_MAX_SCALE ? RATE_MAX_SCALE : scale;
+}
 
+/**
+ *  Refit the exponent of the model from two encodes of similar content,
+ *  smoothed as the frames are not exactly the same.
+ */
+static void update_exponent (double scale0, int size0, double scale1, int size1)
+{
+    if (scale0 == scale1 || size0 == size1 || size0 <= 0 || size1 <= 0)
+        return;
+    double exponent = log ((double) size0 / size1) / log (scale1 / scale0);
+    if (exponent < RATE_MIN_EXPONENT || exponent > RATE_MAX_EXPONENT)
+        return;
+    rate_exponent = 0.5 * rate_exponent + 0.5 * exponent;
+}
 
 /**
  *  Open video source and setup for demuxing and transcoding.
@@ -132,6 +196,23 @@ static int open (const char* source)
     // init jpeg codec
     jpeg_init (decoder_ctx->width, decoder_ctx->height, 0);
 
+    // rate control needs the frame rate for a bitrate and a codec with adjustable quantization
+    if (bitrate > 0)
+    {
+        double fps = av_q2d (stream->avg_frame_rate);
+        if (fps <= 0)
+        {
+            fprintf (stderr, "unknown frame rate, use %s to set the bytes per frame\n", FRAME_SIZE_ARG);
+            return 1;
+        }
+        target_size = bitrate / 8 / fps;
+    }
+    if (target_size > 0 && jpeg_set_option (JPEG_OPTION_QUALITY, scale_to_quality (rate_scale)) != 0)
+    {
+        fprintf (stderr, "rate control is not supported by this codec\n");
+        return 1;
+    }
+
     return 0;
 }
 
@@ -145,10 +226,84 @@ static int close ()
 }
 
 /**
- *  Compress the current frame to dest using JPEG.
- *  Returns size in bytes of the compressed data.
+ *  Compress planar_image to the zeroed jpeg_buffer at quality. The buffer
+ *  starts at the size of a typical frame, one that does not fit is encoded
+ *  again into a buffer grown to the bound of quality.
+ *  Returns size in bytes of the compressed data, 0 on error.
  */
-static int compress (uint8_t* dest)
+static int compress_frame (int quality)
+{
+    size_t   bound;
+    uint8_t* grown;
+    int      size = jpeg_compress_bounded (planar_image, jpeg_buffer, capacity);
+
+    if (size > 0 || capacity >= (bound = jpeg_compress_bound (decoder_ctx->width, decoder_ctx->height, quality)))
+        return size;
+    if ((grown = hugepages_alloc (bound)) == NULL)
+    {
+        fprintf (stderr, "failed to grow the frame buffer to %zu bytes\n", bound);
+        return 0;
+    }
+    hugepages_free (jpeg_buffer, capacity);
+    jpeg_buffer = grown;
+    capacity    = bound;
+    return jpeg_compress_bounded (planar_image, jpeg_buffer, capacity);
+}
+
+/**
+ *  Compress planar_image to jpeg_buffer at the quality predicted to hit
+ *  target_size, once more if it overshoots by too much, and record the
+ *  quality used.
+ *  Returns size in bytes of the compressed data, 0 on error.
+ */
+static int compress_rate_controlled ()
+{
+    static double previous_scale = 0;
+    static int    previous_size  = 0;
+    int    quality = scale_to_quality (rate_scale);
+    double scale   = quality_to_scale (quality);
+    int    size;
+
+    jpeg_set_option (JPEG_OPTION_QUALITY, quality);
+    size = compress_frame (quality);
+    // a refused encode says nothing of the content, keep the model as it is
+    if (size <= 0)
+        return 0;
+    update_exponent (previous_scale, previous_size, scale, size);
+
+    // second pass, predicted from this frame
+    if (size > target_size * RATE_OVERSHOOT && quality > 1)
+    {
+        int retry = scale_to_quality (predict_scale (scale, size));
+        if (retry < quality)
+        {
+            double retry_scale = quality_to_scale (retry);
+            memset (jpeg_buffer, 0, size);
+            jpeg_set_option (JPEG_OPTION_QUALITY, retry);
+            int retry_size = compress_frame (retry);
+            if (retry_size <= 0)
+                return 0;
+            update_exponent (scale, size, retry_scale, retry_size);
+            quality = retry;
+            scale   = retry_scale;
+            size    = retry_size;
+        }
+    }
+
+    previous_scale = scale;
+    previous_size  = size;
+    rate_scale     = predict_scale (scale, size);
+    if (qfp)
+        fputc (quality, qfp);
+    frame_quality = quality;
+    return size;
+}
+
+/**
+ *  Compress the current frame to jpeg_buffer using JPEG.
+ *  Returns size in bytes of the compressed data, 0 on error.
+ */
+static int compress ()
 {
     int compressed_size;
     uint8_t** decoded;
@@ -188,7 +343,10 @@ static int compress (uint8_t* dest)
             planar_image[y * decoder_ctx->width * 2 + x * 4 + 2] = decoded[2][y * strides[2] + x];
 
     // compress
-    compressed_size = jpeg_compress (planar_image, dest);
+    if (target_size > 0)
+        compressed_size = compress_rate_controlled ();
+    else
+        compressed_size = compress_frame (0);
 
     // draw the shit
     load_texture (planar_image, decoder_ctx->width, decoder_ctx->height);
@@ -199,14 +357,29 @@ static int compress (uint8_t* dest)
 
 /**
  *  Transcode the stream.
- *  Takes a function pointer to a store function.
+ *  Takes a function pointer to a store function, called with the data of a
+ *  frame, its size, number and timestamp in microseconds.
  */
-static void transcode (int (*store) (uint8_t*, size_t, int))
+static void transcode (int (*store) (uint8_t*, size_t, int, int64_t))
 {
-    uint8_t* jpeg_buffer = malloc (decoder_ctx->width * decoder_ctx->height * 2);
-    planar_image         = malloc (decoder_ctx->width * decoder_ctx->height * 2);
+    size_t   frame_size  = decoder_ctx->width * decoder_ctx->height * 2;
+    int      written     = 0;
+    // as big as the frame, it holds all but the noisiest frames at high quality
+    capacity             = frame_size;
+    jpeg_buffer          = hugepages_alloc (capacity);
+    planar_image         = hugepages_alloc (frame_size);
     int frame_count      = 0;
 
+    if (jpeg_buffer == NULL || planar_image == NULL)
+    {
+        fprintf (stderr, "failed to allocate frame buffers\n");
+        hugepages_free (jpeg_buffer, capacity);
+        hugepages_free (planar_image, frame_size);
+        jpeg_deinit ();
+        return;
+    }
+    printf ("frame buffers on %s\n", hugepages_mode_name (hugepages_mode ()));
+
     // start transcoding
     while (av_read_frame (fmt_ctx, &packet) >= 0 && frame_count < 1500)
     {
@@ -232,12 +405,18 @@ static void transcode (int (*store) (uint8_t*, size_t, int))
             if (got_frame)
             {
                 frame_count ++;
-                memset (jpeg_buffer, 0, decoder_ctx->width * decoder_ctx->height * 2);
-                int compressed_size = compress (jpeg_buffer);
+                // only what the last frame wrote, or all of a frame that did not fit
+                memset (jpeg_buffer, 0, written > 0 ? written : capacity);
+                int compressed_size = compress ();
                 if (compressed_size > 0)
                 {
-                    store (jpeg_buffer, compressed_size, frame_count);
+                    int64_t pts = av_frame_get_best_effort_timestamp (frame);
+                    store (jpeg_buffer, compressed_size, frame_count,
+                           pts == AV_NOPTS_VALUE ? MJPG_NO_TIMESTAMP : av_rescale_q (pts, stream->time_base, AV_TIME_BASE_Q));
                 }
+                else
+                    fprintf (stderr, "could not compress frame %d\n", frame_count);
+                written = compressed_size;
             }
             packet.size -= ret;
             packet.data += ret;
@@ -246,8 +425,8 @@ static void transcode (int (*store) (uint8_t*, size_t, int))
         av_free_packet (&original);
     }
 
-    free (jpeg_buffer);
-    free (planar_image);
+    hugepages_free (jpeg_buffer, capacity);
+    hugepages_free (planar_image, frame_size);
     jpeg_deinit ();
 }
 
@@ -265,7 +444,7 @@ void transcoder_deinit ()
 }
 
 
-static int store_separate_files (uint8_t* data, size_t size, int frame_count)
+static int store_separate_files (uint8_t* data, size_t size, int frame_count, int64_t timestamp)
 {
     char path[256] = { 0 };
     sprintf (path, "%s/%d.jpg", MULTIFILES_PATH, frame_count);
@@ -276,14 +455,13 @@ static int store_separate_files (uint8_t* data, size_t size, int frame_count)
     return 0;
 }
 
-static int store_single_file (uint8_t* data, size_t size, int frame_count)
+static int store_single_file (uint8_t* data, size_t size, int frame_count, int64_t timestamp)
 {
-    int pos = ftell (fp);
-    int s = size;
-    // fseek  (ifp, frame_count * sizeof (int) * 2, SEEK_SET);
-    fwrite (&pos, 1, sizeof (int), ifp);
-    fwrite (&s, 1, sizeof (int), ifp);
-    fwrite (data, 1, size, fp);
+    if (mjpg_write (&video, data, size, timestamp, frame_quality) != 0)
+    {
+        fprintf (stderr, "could not store frame %d\n", frame_count);
+        return 1;
+    }
     return 0;
 }
 
@@ -293,7 +471,11 @@ int transcode__separate_files (const char* source)
     // open media
     if (open (source) != 0)
         return 1;
+    if (target_size > 0)
+        qfp = fopen (MULTIFILES_PATH"/quality", "wb");
     transcode (store_separate_files);
+    if (qfp)
+        fclose (qfp);
     close ();
     return 0;
 }
@@ -301,15 +483,22 @@ int transcode__separate_files (const char* source)
 
 int transcode__one_file (const char* source)
 {
+    int ret;
+
     if (open (source) != 0)
         return 1;
-    fp = fopen (SINGLEFILE_PATH"/video.mjpg", "wb");
-    ifp = fopen (SINGLEFILE_PATH"/index", "wb");
+    // the frame table holds the size, timestamp and quality of every frame
+    if (mjpg_create (&video, SINGLEFILE_PATH"/video.mjpg", decoder_ctx->width, decoder_ctx->height, MJPG_CHECKSUMS) != 0)
+    {
+        fprintf (stderr, "could not create %s\n", SINGLEFILE_PATH"/video.mjpg");
+        close ();
+        return 1;
+    }
     transcode (store_single_file);
-    fclose (fp);
-    fclose (ifp);
+    if ((ret = mjpg_finish (&video)) != 0)
+        fprintf (stderr, "could not write the frame table of %s\n", SINGLEFILE_PATH"/video.mjpg");
     close ();
-    return 0;
+    return ret;
 }
 
 
@@ -317,10 +506,20 @@ int main (int argc, char** argv)
 {
     if (argc < 3)
     {
-        printf ("usage: %s <%s|%s> <source>\n", argv[0], TRANSCODE_MULTI_ARG, TRANSCODE_SINGLE_ARG);
+        printf ("usage: %s <%s|%s> <source> [%s <bytes per frame> | %s <bits per second>]\n",
+                argv[0], TRANSCODE_MULTI_ARG, TRANSCODE_SINGLE_ARG, FRAME_SIZE_ARG, BITRATE_ARG);
         return 1;
     }
 
+    // optional rate control
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp (argv[i], FRAME_SIZE_ARG) == 0)
+            target_size = atof (argv[i + 1]);
+        else if (strcmp (argv[i], BITRATE_ARG) == 0)
+            bitrate = atof (argv[i + 1]);
+    }
+
     int ret = 0;
     transcoder_init ();
     init_ui (960, 540);
@@ -203,11 +203,8 @@ static int init_opengl ()
     glBindBuffer    (GL_TEXTURE_BUFFER, texture_buffer);
     glBufferData    (GL_TEXTURE_BUFFER, MAX_IMAGE_SIZE * 2, NULL, GL_DYNAMIC_DRAW);
     glBindTexture   (GL_TEXTURE_BUFFER, texture);
+    // read with texelFetch, buffer textures have no filtering or wrapping to set
     glTexBuffer     (GL_TEXTURE_BUFFER, GL_RGBA8, texture_buffer);
-    glTexParameteri (GL_TEXTURE_BUFFER, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri (GL_TEXTURE_BUFFER, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri (GL_TEXTURE_BUFFER, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
-    glTexParameteri (GL_TEXTURE_BUFFER, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
 #endif
 
     glActiveTexture (GL_TEXTURE1);
@@ -302,6 +299,28 @@ void load_texture (uint8_t* data, int width, int height)
 }
 
 
+uint8_t* map_texture (int width, int height)
+{
+#ifdef __OPENGL_ES__
+    return NULL;
+#else
+    glUniform1i   (glGetUniformLocation (program, "width"),  width >> 1);
+    glUniform1i   (glGetUniformLocation (program, "height"), height);
+    glBindBuffer  (GL_TEXTURE_BUFFER, texture_buffer);
+    // orphan the previous frame so mapping does not wait for it to be drawn
+    glBufferData  (GL_TEXTURE_BUFFER, width * height * 2, NULL, GL_STREAM_DRAW);
+    return glMapBuffer (GL_TEXTURE_BUFFER, GL_WRITE_ONLY);
+#endif
+}
+
+
+void unmap_texture ()
+{
+#ifndef __OPENGL_ES__
+    glUnmapBuffer (GL_TEXTURE_BUFFER);
+#endif
+}
+
 int init_ui (int w, int h)
 {
     int ret;
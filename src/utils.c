@@ -1,6 +1,11 @@
 #include "utils.h"
+#include "jpeg/jpeg.h"
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define BLOCK_SIZE  8
 #define BLOCK_TSIZE 64
@@ -72,6 +77,23 @@ inline int write_bits (uint16_t symbol, uint8_t size, uint8_t* buffer, int* p)
     return ret;
 }
 
+void append_bits (const uint8_t* source, int n, uint8_t* buffer, int* p)
+{
+    uint8_t* b     = buffer + ((*p) >> 3);
+    int      shift = (*p) & 7;
+    int      bytes = (n + 7) >> 3;
+
+    if (shift == 0)
+        memcpy (b, source, bytes);
+    else
+        for (int i = 0; i < bytes; i ++)
+        {
+            b[i]     |= source[i] >> shift;
+            b[i + 1] |= source[i] << (8 - shift);
+        }
+    *p += n;
+}
+
 inline uint16_t read_value (uint8_t* buffer, int* p, uint8_t size)
 {
     uint16_t v = 0;
@@ -97,19 +119,85 @@ int load_file (const char* source, void** destination, size_t* size)
     *size = ftell (fp) + 1;
     fseek (fp, 0, SEEK_SET);
 
-    // allocate buffer to contain source
-    *destination = malloc (*size);
-    memset (*destination, 0, *size);
+    // allocate buffer to contain source, padded for decoding in place.
+    // calloc has large buffers zeroed by the kernel, no memset
+    if ((*destination = calloc (*size + JPEG_DECODE_PADDING, 1)) == NULL)
+    {
+        fclose (fp);
+        return 1;
+    }
 
     // read contents and close file
-    int n = fread (*destination, 1, (*size) - 1, fp);
+    size_t n = fread (*destination, 1, (*size) - 1, fp);
+    fclose (fp);
     if (n != (*size) - 1)
+    {
+        free (*destination);
+        *destination = NULL;
         return 1;
+    }
+    return 0;
+}
 
-    fclose (fp);
+/**
+ *  Bytes of the view of a file of size bytes, whole pages covering the
+ *  file and the padding.
+ */
+static inline size_t view_length (size_t size)
+{
+    size_t page = sysconf (_SC_PAGESIZE);
+    return (size + JPEG_DECODE_PADDING + page - 1) & ~(page - 1);
+}
+
+int map_file (const char* source, void** view, size_t* size)
+{
+    struct stat st;
+    size_t      length;
+    uint8_t*    v;
+    int         fd = open (source, O_RDONLY);
+
+    if (fd < 0)
+        return 1;
+    if (fstat (fd, &st) != 0)
+    {
+        close (fd);
+        return 1;
+    }
+    *size  = st.st_size;
+    length = view_length (*size);
+
+    // zero pages for the padding, then the file mapped over the start of them.
+    // the rest of its last page past the end reads as zeroes too
+    v = mmap (NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (v == MAP_FAILED)
+    {
+        close (fd);
+        return 1;
+    }
+    if (*size > 0 && mmap (v, *size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap (v, length);
+        close (fd);
+        return 1;
+    }
+    close (fd);
+
+    // read ahead the whole file, it is read once front to back
+    if (*size > 0)
+    {
+        madvise (v, *size, MADV_SEQUENTIAL);
+        madvise (v, *size, MADV_WILLNEED);
+    }
+    *view = v;
     return 0;
 }
 
+void unmap_file (void* view, size_t size)
+{
+    if (view != NULL)
+        munmap (view, view_length (size));
+}
+
 void print_binary (uint8_t* buffer, int p, int size)
 {
     for (int i = 0; i < size; i ++)